@@ -19,6 +19,7 @@ struct BinaryContext;
 namespace sw
 {
 
+struct FileRecord;
 struct FileStorage;
 struct Program;
 
@@ -100,6 +101,10 @@ struct SW_BUILDER_API Command : Node, std::enable_shared_from_this<Command>,
     //std::shared_ptr<Dependency> dependency; // TODO: hide
     bool silent = false;
     bool always = false;
+    /// immutable argument block shared between commands (e.g. options of all target files)
+    /// it is inserted into args at shared_args_pos only while the command is executed
+    std::shared_ptr<const Strings> shared_args;
+    size_t shared_args_pos = 0;
 
     enum
     {
@@ -109,6 +114,16 @@ struct SW_BUILDER_API Command : Node, std::enable_shared_from_this<Command>,
     };
     int maybe_unused = 0;
 
+    /// file records resolved once in prepare(), used on hot paths
+    /// instead of registering paths in the file storage again
+    struct FileRecords
+    {
+        FileRecord *program = nullptr;
+        std::vector<FileRecord *> inputs;
+        std::vector<FileRecord *> intermediate;
+        std::vector<FileRecord *> outputs;
+    };
+
     Command();
     Command(::sw::FileStorage &fs);
     virtual ~Command();
@@ -149,6 +164,14 @@ struct SW_BUILDER_API Command : Node, std::enable_shared_from_this<Command>,
     void updateFilesHash() const;
     Files getGeneratedDirs() const;
     void addPathDirectory(const path &p);
+    void addSharedArgs(const std::shared_ptr<const Strings> &a);
+    /// args with the shared block
+    Strings getArguments() const;
+    /// environment with the path directory
+    decltype(environment) getEnvironment() const;
+    const FileRecords &getFileRecords() const;
+    /// prepare() will add input/output deps again, e.g. after they were cleared
+    void resetPrepared() { prepared = false; }
 
     //void load(BinaryContext &bctx);
     //void save(BinaryContext &bctx);
@@ -159,8 +182,14 @@ protected:
     mutable size_t hash = 0;
 
     void addInputOutputDeps();
+    void resolveFileRecords() const;
 
 private:
+    mutable FileRecords records;
+    mutable bool records_resolved = false;
+    // PATH value is shared by all commands with the same directory
+    std::shared_ptr<const String> path_env;
+
     void execute1(std::error_code *ec = nullptr);
 };
 
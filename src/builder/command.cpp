@@ -77,15 +77,17 @@ bool CommandStorage::isOutdated(const sw::builder::Command &c)
     bool changed = false;
 
     // always check program and all deps are known
-    changed = File(c.program, *c.fs).isChanged();
-    for (auto &i : c.inputs)
-        changed |= File(i, *c.fs).isChanged();
-    for (auto &i : c.outputs)
-        changed |= File(i, *c.fs).isChanged();
+    auto &r = c.getFileRecords();
+    if (r.program)
+        changed = r.program->isChanged();
+    for (auto f : r.inputs)
+        changed |= f->isChanged();
+    for (auto f : r.outputs)
+        changed |= f->isChanged();
 
     auto k = std::hash<sw::builder::Command>()(c);
-    auto r = commands.insert_ptr(k, 0);
-    if (r.second)
+    auto cr = commands.insert_ptr(k, 0);
+    if (cr.second)
     {
         // we have insertion, no previous value available
         // so outdated
@@ -123,8 +125,8 @@ bool CommandStorage::isOutdated(const sw::builder::Command &c)
     return changed;
 
     // we don't see changes, now check command hash
-    if (!r.second)
-        return *r.first != c.calculateFilesHash();
+    if (!cr.second)
+        return *cr.first != c.calculateFilesHash();
 
     return false;
 }
@@ -158,7 +160,8 @@ size_t Command::getHash() const
     auto h = std::hash<path>()(program);
 
     // must sort args first
-    std::set<String> args_sorted(args.begin(), args.end());
+    auto a = getArguments();
+    std::set<String> args_sorted(a.begin(), a.end());
     for (auto &a : args_sorted)
         hash_combine(h, std::hash<String>()(a));
 
@@ -180,11 +183,13 @@ size_t Command::getHashAndSave() const
 size_t Command::calculateFilesHash() const
 {
     auto h = getHash();
-    hash_combine(h, File(program, *fs).getFileRecord().getHash());
-    for (auto &i : inputs)
-        hash_combine(h, File(i, *fs).getFileRecord().getHash());
-    for (auto &i : outputs)
-        hash_combine(h, File(i, *fs).getFileRecord().getHash());
+    auto &r = getFileRecords();
+    if (r.program)
+        hash_combine(h, r.program->getHash());
+    for (auto f : r.inputs)
+        hash_combine(h, f->getHash());
+    for (auto f : r.outputs)
+        hash_combine(h, f->getHash());
     return h;
 }
 
@@ -286,13 +291,37 @@ path Command::redirectStderr(const path &p)
     return p;
 }
 
+void Command::resolveFileRecords() const
+{
+    records = {};
+    if (!program.empty())
+        records.program = &File(program, *fs).getFileRecord();
+    auto resolve = [this](const Files &files, auto &out)
+    {
+        out.reserve(files.size());
+        for (auto &p : files)
+            out.push_back(&File(p, *fs).getFileRecord());
+    };
+    resolve(inputs, records.inputs);
+    resolve(intermediate, records.intermediate);
+    resolve(outputs, records.outputs);
+    records_resolved = true;
+}
+
+const Command::FileRecords &Command::getFileRecords() const
+{
+    if (!records_resolved)
+        resolveFileRecords();
+    return records;
+}
+
 void Command::addInputOutputDeps()
 {
-    for (auto &p : inputs)
+    auto &r = getFileRecords();
+    for (auto f : r.inputs)
     {
-        File f(p, *fs);
-        if (f.isGenerated())
-            dependencies.insert(f.getFileRecord().getGenerator());
+        if (f->isGenerated())
+            dependencies.insert(f->getGenerator());
         else
         {
             // do we really need this? yes!
@@ -303,10 +332,9 @@ void Command::addInputOutputDeps()
         }
     }
     // do we really need this?
-    for (auto &p : outputs)
+    for (auto f : r.outputs)
     {
-        File f(p, *fs);
-        f.addExplicitDependency(inputs);
+        File(*f).addExplicitDependency(r.inputs);
         //f.addImplicitDependency(inputs);
     }
 }
@@ -329,9 +357,12 @@ void Command::prepare()
     if (!err.file.empty())
         addOutput(err.file);
 
+    // i/o sets are final here
+    resolveFileRecords();
+
     // add more deps
-    if (File(program, *fs).isGenerated())
-        dependencies.insert(File(program, *fs).getFileRecord().getGenerator());
+    if (auto p = getFileRecords().program; p && p->isGenerated())
+        dependencies.insert(p->getGenerator());
     addInputOutputDeps();
 
     prepared = true;
@@ -379,6 +410,19 @@ void Command::execute1(std::error_code *ec)
             rp->unlock();
     };
 
+    // shared args and environment are copied into the command only during execution
+    auto own_args = args;
+    auto own_environment = environment;
+    args = getArguments();
+    environment = getEnvironment();
+    auto shared = std::move(shared_args);
+    SCOPE_EXIT
+    {
+        args = std::move(own_args);
+        environment = std::move(own_environment);
+        shared_args = std::move(shared);
+    };
+
     // Try to construct command line first.
     // Some systems have limitation on its length.
 
@@ -565,29 +609,25 @@ void Command::execute1(std::error_code *ec)
             fr.refreshed = false;
             fr.isChanged();
         }*/
-        for (auto &i : intermediate)
+        for (auto fr : getFileRecords().intermediate)
         {
-            File f(i, *fs);
             /*if (!fs::exists(i))
                 f.getFileRecord().flags.set(ffNotExists);
             else*/
             //f.getFileRecord().load();
-            auto &fr = f.getFileRecord();
-            fr.data->refreshed = false;
-            fr.isChanged();
-            fr.updateLwt();
+            fr->data->refreshed = false;
+            fr->isChanged();
+            fr->updateLwt();
         }
-        for (auto &i : outputs)
+        for (auto fr : getFileRecords().outputs)
         {
-            File f(i, *fs);
             /*if (!fs::exists(i))
                 f.getFileRecord().flags.set(ffNotExists);
             else*/
             //f.getFileRecord().load();
-            auto &fr = f.getFileRecord();
-            fr.data->refreshed = false;
-            fr.isChanged();
-            fr.updateLwt();
+            fr->data->refreshed = false;
+            fr->isChanged();
+            fr->updateLwt();
         }
 
         updateFilesHash();
@@ -604,6 +644,11 @@ bool Command::needsResponseFile() const
     size_t sz = program.u8string().size() + 3;
     for (auto &a : args)
         sz += a.size() + 3;
+    if (shared_args)
+    {
+        for (auto &a : *shared_args)
+            sz += a.size() + 3;
+    }
     return sz >
 #ifdef _WIN32
         8100 // win have 8192 limit, we take a bit fewer symbols
@@ -683,13 +728,57 @@ Files Command::getGeneratedDirs() const
 
 void Command::addPathDirectory(const path &p)
 {
+    static std::mutex m;
+    static std::unordered_map<path, std::shared_ptr<const String>> values;
+
+    std::unique_lock lk(m);
+    auto &v = values[p];
+    if (!v)
+    {
 #ifdef _WIN32
-    String s = getenv("Path");
-    environment["Path"] = s + ";" + normalize_path_windows(p);
+        String s = getenv("Path");
+        v = std::make_shared<const String>(s + ";" + normalize_path_windows(p));
 #else
-    String s = getenv("PATH");
-    environment["PATH"] = s + ":" + p.u8string();
+        String s = getenv("PATH");
+        v = std::make_shared<const String>(s + ":" + p.u8string());
 #endif
+    }
+    path_env = v;
+}
+
+void Command::addSharedArgs(const std::shared_ptr<const Strings> &a)
+{
+    // only one block is kept, previous one becomes ordinary args
+    if (shared_args)
+        args.insert(args.begin() + shared_args_pos, shared_args->begin(), shared_args->end());
+    shared_args = a;
+    shared_args_pos = args.size();
+}
+
+Strings Command::getArguments() const
+{
+    if (!shared_args)
+        return args;
+    Strings a;
+    a.reserve(args.size() + shared_args->size());
+    a.insert(a.end(), args.begin(), args.begin() + shared_args_pos);
+    a.insert(a.end(), shared_args->begin(), shared_args->end());
+    a.insert(a.end(), args.begin() + shared_args_pos, args.end());
+    return a;
+}
+
+decltype(Command::environment) Command::getEnvironment() const
+{
+    auto e = environment;
+    if (path_env)
+    {
+#ifdef _WIN32
+        e.emplace("Path", *path_env);
+#else
+        e.emplace("PATH", *path_env);
+#endif
+    }
+    return e;
 }
 
 /*void Command::load(BinaryContext &bctx)
@@ -716,10 +805,11 @@ size_t _ExecuteCommand::getHash() const
     auto h = std::hash<path>()(getProgram());
     hash_combine(h, std::hash<String>()(file ? file : ""));
     hash_combine(h, std::hash<int>()(line));
-    for (auto &i : inputs)
-        hash_combine(h, File(i, *fs).getFileRecord().getHash());
-    for (auto &i : outputs)
-        hash_combine(h, File(i, *fs).getFileRecord().getHash());
+    auto &r = getFileRecords();
+    for (auto f : r.inputs)
+        hash_combine(h, f->getHash());
+    for (auto f : r.outputs)
+        hash_combine(h, f->getHash());
     return hash = h;
 }
 
@@ -727,16 +817,18 @@ void _ExecuteCommand::prepare()
 {
     if (prepared)
         return;
+    resolveFileRecords();
     addInputOutputDeps();
     prepared = true;
 }
 
 bool _ExecuteCommand::isOutdated() const
 {
-    if (std::none_of(inputs.begin(), inputs.end(),
-        [this](auto &d) { return File(d, *fs).isChanged(); }) &&
-        std::none_of(outputs.begin(), outputs.end(),
-            [this](auto &d) { return File(d, *fs).isChanged(); }))
+    auto &r = getFileRecords();
+    if (std::none_of(r.inputs.begin(), r.inputs.end(),
+        [](auto f) { return f->isChanged(); }) &&
+        std::none_of(r.outputs.begin(), r.outputs.end(),
+            [](auto f) { return f->isChanged(); }))
         return false;
     return true;
 }
@@ -757,8 +849,8 @@ void _ExecuteCommand::execute()
     f();
 
     // force outputs update
-    for (auto &o : outputs)
-        File(o, *fs).getFileRecord().load();
+    for (auto f : getFileRecords().outputs)
+        f->load();
 }
 
 }
@@ -8,7 +8,12 @@
 
 #include <junction/ConcurrentMap_Leapfrog.h>
 
+#include <array>
+#include <atomic>
 #include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 template <class K, class V>
 struct ConcurrentMap
@@ -22,9 +27,15 @@ struct ConcurrentMap
         m = std::make_unique<MapType>();
     }
 
+    ~ConcurrentMap()
+    {
+        delete zero.load();
+    }
+
     void clear()
     {
         m = std::make_unique<MapType>();
+        delete zero.exchange(nullptr);
     }
 
     insert_type insert(const value_type &v)
@@ -35,8 +46,19 @@ struct ConcurrentMap
     template <class Deleter>
     insert_type insert(K k, const V &v, Deleter &&d)
     {
+        // zero is a reserved (null) key in junction maps, it has its own slot
         if (k == 0)
-            throw std::runtime_error("ConcurrentMap: zero key");
+        {
+            auto value = zero.load();
+            if (value)
+                return { value, false };
+            auto nv = new V(v);
+            if (zero.compare_exchange_strong(value, nv))
+                return { nv, true };
+            delete nv;
+            return { value, false };
+        }
+
         auto i = m->insertOrFind(k);
         auto value = i.getValue();
         if (!value)
@@ -83,36 +105,97 @@ struct ConcurrentMap
         return *insert(k).first;
     }
 
+    /// iterator does not visit zero key, use forEach() to get all entries
     auto getIterator()
     {
         return typename MapType::Iterator(*m);
     }
 
+    template <class F>
+    void forEach(F &&f)
+    {
+        if (auto v = zero.load())
+            f(K(0), v);
+        for (auto i = getIterator(); i.isValid(); i.next())
+            f(i.getKey(), i.getValue());
+    }
+
 private:
     std::unique_ptr<MapType> m;
+    std::atomic<V*> zero{ nullptr };
 };
 
 template <class V>
 using ConcurrentMapSimple = ConcurrentMap<size_t, V>;
 
-template <class K, class V>
-struct ConcurrentHashMap : ConcurrentMapSimple<V>
+/// Concurrent map that stores and compares full keys.
+/// Entries are split into shards with their own locks,
+/// values have stable addresses and are owned by the map.
+/// Entries are never erased one by one, so returned pointers
+/// and iterator snapshots are valid until clear() or destruction.
+template <class K, class V, class Hash = std::hash<K>, size_t NShards = 64>
+struct ConcurrentHashMap
 {
-    using Base = ConcurrentMapSimple<V>;
-    using Base::operator[];
     using value_type = std::pair<K, V>;
-    using insert_type = typename Base::insert_type;
+    using insert_type = std::pair<V*, bool>;
+
+    /// snapshot of the map at the moment of creation
+    struct Iterator
+    {
+        bool isValid() const { return i < items.size(); }
+        void next() { i++; }
+        const K &getKey() const { return *items[i].first; }
+        V *getValue() const { return items[i].second; }
 
-    using Base::insert;
+    private:
+        std::vector<std::pair<const K *, V *>> items;
+        size_t i = 0;
 
-    insert_type insert(const K &k, const V &v = V())
+        friend struct ConcurrentHashMap;
+    };
+
+    ConcurrentHashMap() = default;
+    ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+    ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+    /// not safe against concurrent readers
+    void clear()
     {
-        return insert({ k, v });
+        for (auto &s : shards)
+        {
+            std::unique_lock lk(s.m);
+            s.map.clear();
+        }
     }
 
     insert_type insert(const value_type &v)
     {
-        return Base::insert(std::hash<K>()(v.first), v.second);
+        return insert(v.first, v.second);
+    }
+
+    insert_type insert(const K &k, const V &v = V())
+    {
+        const auto h = Hash()(k);
+        auto &s = shards[getShardIndex(h)];
+        {
+            std::shared_lock lk(s.m);
+            if (auto p = s.find(h, k))
+                return { p, false };
+        }
+        std::unique_lock lk(s.m);
+        if (auto p = s.find(h, k))
+            return { p, false };
+        auto i = s.map.emplace(h, Node{ k, std::make_unique<V>(v) });
+        return { i->second.value.get(), true };
+    }
+
+    /// returns nullptr if key is not present
+    V *find(const K &k) const
+    {
+        const auto h = Hash()(k);
+        auto &s = shards[getShardIndex(h)];
+        std::shared_lock lk(s.m);
+        return s.find(h, k);
     }
 
     V &operator[](const K &k)
@@ -120,8 +203,58 @@ struct ConcurrentHashMap : ConcurrentMapSimple<V>
         return *insert(k).first;
     }
 
-    const V &operator[](const K &k) const
+    size_t size() const
     {
-        return *insert(k).first;
+        size_t n = 0;
+        for (auto &s : shards)
+        {
+            std::shared_lock lk(s.m);
+            n += s.map.size();
+        }
+        return n;
+    }
+
+    Iterator getIterator() const
+    {
+        Iterator i;
+        for (auto &s : shards)
+        {
+            std::shared_lock lk(s.m);
+            for (auto &[h, n] : s.map)
+                i.items.emplace_back(&n.key, n.value.get());
+        }
+        return i;
+    }
+
+private:
+    struct Node
+    {
+        K key;
+        std::unique_ptr<V> value;
+    };
+
+    struct Shard
+    {
+        mutable std::shared_mutex m;
+        // hash -> nodes, equal hashes are resolved by full key comparison
+        std::unordered_multimap<size_t, Node> map;
+
+        V *find(size_t h, const K &k) const
+        {
+            auto [b, e] = map.equal_range(h);
+            for (auto i = b; i != e; ++i)
+            {
+                if (i->second.key == k)
+                    return i->second.value.get();
+            }
+            return nullptr;
+        }
+    };
+
+    std::array<Shard, NShards> shards;
+
+    static size_t getShardIndex(size_t h)
+    {
+        return (h ^ (h >> 32)) % NShards;
     }
 };
@@ -9,6 +9,9 @@
 #include "command_storage.h"
 #include "file_storage.h"
 
+/// format of file records, used by both the db and the log file names
+#define FILE_DB_FORMAT_VERSION 2
+
 namespace sw
 {
 
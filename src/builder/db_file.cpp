@@ -22,7 +22,6 @@ void save_from_memory_to_file(const path &fn, sqlite3 *db);
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db_file");
 
-#define FILE_DB_FORMAT_VERSION 1
 #define COMMAND_DB_FORMAT_VERSION 1
 
 namespace sw
@@ -51,7 +50,11 @@ static path getCommandsDbFilename()
     return p;
 }
 
-static void load(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRecord> &files, std::unordered_map<int64_t, std::unordered_set<int64_t>> &deps)
+// full paths are used as keys, hashes may collide
+using FileRecordsByPath = std::unordered_map<String, FileRecord *>;
+using FileDepsByPath = std::unordered_map<String, std::unordered_set<String>>;
+
+static void load(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRecord> &files, FileRecordsByPath &records, FileDepsByPath &deps)
 {
     ScopedShareableFileLock lk(fn);
 
@@ -68,15 +71,15 @@ static void load(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRe
     }
     while (!b.eof())
     {
-        size_t h;
-        b.read(h);
-
         String p;
         b.read(p);
 
-        auto kv = files.insert(h);
+        auto r = fs.registerFile(p);
+        auto kv = files.insert(p);
         kv.first->file = p;
-        kv.first->data = fs.registerFile(p)->data;
+        kv.first->id = r->id;
+        kv.first->data = r->data;
+        records[p] = kv.first;
 
         decltype(kv.first->data->last_write_time) lwt;
         b.read(lwt);
@@ -91,14 +94,14 @@ static void load(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRe
 
         for (int i = 0; i < n; i++)
         {
-            size_t h2;
-            b.read(h2);
-            deps[h].insert(h2);
+            String p2;
+            b.read(p2);
+            deps[p].insert(p2);
         }
     }
 }
 
-static void load_log(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRecord> &files, std::unordered_map<int64_t, std::unordered_set<int64_t>> &deps)
+static void load_log(FileStorage &fs, const path &fn, ConcurrentHashMap<path, FileRecord> &files, FileRecordsByPath &records, FileDepsByPath &deps)
 {
     ScopedShareableFileLock lk(fn);
 
@@ -109,23 +112,29 @@ static void load_log(FileStorage &fs, const path &fn, ConcurrentHashMap<path, Fi
             throw std::runtime_error("Cannot open file: " + fn.u8string());
         return;
     }
+    auto read_string = [fp]()
+    {
+        size_t sz = 0;
+        fread(&sz, sizeof(sz), 1, fp);
+        String s(sz, 0);
+        if (sz)
+            fread(&s[0], sz, 1, fp);
+        return s;
+    };
+
     while (!feof(fp))
     {
-        int64_t h;
-        fread(&h, sizeof(h), 1, fp);
+        auto p = read_string();
 
         if (feof(fp))
             break;
 
-        size_t sz;
-        fread(&sz, sizeof(sz), 1, fp);
-
-        String p(sz, 0);
-        fread(&p[0], sz, 1, fp);
-
-        auto kv = files.insert(h);
+        auto r = fs.registerFile(p);
+        auto kv = files.insert(p);
         kv.first->file = p;
-        kv.first->data = fs.registerFile(p)->data;
+        kv.first->id = r->id;
+        kv.first->data = r->data;
+        records[p] = kv.first;
 
         decltype(kv.first->data->last_write_time) lwt;
         fread(&lwt, sizeof(kv.first->data->last_write_time), 1, fp);
@@ -147,12 +156,7 @@ static void load_log(FileStorage &fs, const path &fn, ConcurrentHashMap<path, Fi
         fread(&n, sizeof(n), 1, fp);
 
         for (size_t i = 0; i < n; i++)
-        {
-            int64_t h2;
-            fread(&h2, sizeof(h2), 1, fp);
-
-            deps[h].insert(h2);
-        }
+            deps[p].insert(read_string());
     }
     fclose(fp);
 }
@@ -165,22 +169,24 @@ Db &getDb()
 
 void FileDb::load(FileStorage &fs, ConcurrentHashMap<path, FileRecord> &files) const
 {
-    std::unordered_map<int64_t, std::unordered_set<int64_t>> deps;
+    FileRecordsByPath records;
+    FileDepsByPath deps;
 
-    sw::load(fs, getFilesDbFilename(fs.config), files, deps);
-    sw::load_log(fs, getFilesLogFileName(fs.config), files, deps);
+    sw::load(fs, getFilesDbFilename(fs.config), files, records, deps);
+    sw::load_log(fs, getFilesLogFileName(fs.config), files, records, deps);
     error_code ec;
     fs::remove(getFilesLogFileName(fs.config), ec);
 
     for (auto &[k, v] : deps)
     {
-        for (auto &h2 : v)
+        auto r = records.find(k);
+        if (r == records.end())
+            continue;
+        for (auto &p2 : v)
         {
-            if (!h2)
-                continue;
-            auto k2 = &files[h2];
-            if (k2 && !k2->file.empty())
-                files[k].implicit_dependencies.insert({ k2->file, k2 });
+            auto k2 = records.find(p2);
+            if (k2 != records.end() && k2->second->id)
+                r->second->implicit_dependencies.insert(k2->second->id);
         }
     }
 }
@@ -211,15 +217,13 @@ void FileDb::save(FileStorage &fs, ConcurrentHashMap<path, FileRecord> &files) c
         if (!f.data)
             continue;
 
-        auto h1 = std::hash<path>()(f.file);
-        b.write(h1);
         b.write(normalize_path(f.file));
         b.write(f.data->last_write_time.time_since_epoch().count());
         //b.write(f.data->size);
         b.write(f.implicit_dependencies.size());
 
-        for (auto &[f, d] : f.implicit_dependencies)
-            b.write(std::hash<path>()(d->file));
+        for (auto id : f.implicit_dependencies)
+            b.write(normalize_path(getPathTable().get(id)));
     }
     b.save(f);
 }
@@ -245,7 +249,6 @@ void FileDb::write(std::vector<uint8_t> &v, const FileRecord &f) const
 {
     v.clear();
 
-    write_int(v, std::hash<path>()(f.file));
     write_str(v, normalize_path(f.file));
     write_int(v, f.data->last_write_time);
     //write_int(v, f.data->size);
@@ -254,8 +257,8 @@ void FileDb::write(std::vector<uint8_t> &v, const FileRecord &f) const
     auto n = f.implicit_dependencies.size();
     write_int(v, n);
 
-    for (auto &[f, d] : f.implicit_dependencies)
-        write_int(v, std::hash<path>()(d->file));
+    for (auto id : f.implicit_dependencies)
+        write_str(v, normalize_path(getPathTable().get(id)));
 }
 
 void FileDb::load(ConcurrentCommandStorage &commands) const
@@ -285,11 +288,11 @@ void FileDb::load(ConcurrentCommandStorage &commands) const
 void FileDb::save(ConcurrentCommandStorage &commands) const
 {
     primitives::BinaryContext b(10'000'000); // reserve amount
-    for (auto i = commands.getIterator(); i.isValid(); i.next())
+    commands.forEach([&b](auto k, auto v)
     {
-        b.write(i.getKey());
-        b.write(*i.getValue());
-    }
+        b.write(k);
+        b.write(*v);
+    });
     b.save(getCommandsDbFilename());
 }
 
@@ -29,6 +29,9 @@ struct ExecutionPlan
         {
             c->dependendent_commands.clear();
             c->dependencies.clear();
+            // let the next plan add input/output deps again
+            if constexpr (std::is_same_v<T, sw::builder::Command>)
+                c->resetPrepared();
         }
     }
 
@@ -137,12 +140,12 @@ struct ExecutionPlan
             insert(c->getName());
             insert(c->program.u8string());
             insert(c->working_directory.u8string());
-            for (auto &a : c->args)
+            for (auto &a : c->getArguments())
                 insert(a);
             insert(c->in.file.u8string());
             insert(c->out.file.u8string());
             insert(c->err.file.u8string());
-            for (auto &[k, v] : c->environment)
+            for (auto &[k, v] : c->getEnvironment())
             {
                 insert(k);
                 insert(v);
@@ -174,20 +177,41 @@ struct ExecutionPlan
                 dups[k].push_back(c);
             }
 
+            // equal hashes are not enough, e.g. the same args in different order
+            auto same = [](const T &c1, const T &c2)
+            {
+                return c1.getProgram() == c2.getProgram() &&
+                    c1.working_directory == c2.working_directory &&
+                    c1.in.file == c2.in.file &&
+                    c1.out.file == c2.out.file &&
+                    c1.err.file == c2.err.file &&
+                    c1.inputs == c2.inputs &&
+                    c1.outputs == c2.outputs &&
+                    c1.getArguments() == c2.getArguments() &&
+                    c1.getEnvironment() == c2.getEnvironment();
+            };
+
             // create replacements
+            // configuration independent commands of different solutions are merged here too
             std::unordered_map<PtrT /*dup*/, PtrT /*repl*/> repls;
             for (auto &[h,v] : dups)
             {
-                if (v.size() < 2)
-                    continue;
-                // we take back command as its easier to take
-                auto repl = v.back();
-                v.pop_back();
-                for (auto &c : v)
+                while (v.size() > 1)
                 {
-                    repls[c] = repl;
-                    // remove dups from cmds
-                    cmds.erase(c);
+                    // we take back command as its easier to take
+                    auto repl = v.back();
+                    v.pop_back();
+                    auto i = std::partition(v.begin(), v.end(), [&same, &repl](const auto &c)
+                    {
+                        return !same(*c, *repl);
+                    });
+                    for (auto j = i; j != v.end(); j++)
+                    {
+                        repls[*j] = repl;
+                        // remove dups from cmds
+                        cmds.erase(*j);
+                    }
+                    v.erase(i, v.end());
                 }
             }
 
@@ -22,6 +22,7 @@
 #include <primitives/debug.h>
 #include <primitives/sw/settings.h>
 
+#include <array>
 #include <sstream>
 
 #include <primitives/log.h>
@@ -58,6 +59,8 @@ path getFilesLogFileName(const String &config)
     auto p = bp.parent_path() / bp.filename().stem();
     std::ostringstream ss;
     //ss << "." << sha256_short(boost::dll::program_location().string());
+    // a log of an older record format must not be replayed
+    ss << "." << FILE_DB_FORMAT_VERSION;
     p += ss.str();
     p += bp.extension();
     return p;
@@ -80,6 +83,11 @@ File::File(const path &p, FileStorage &s)
         r->file = file;
 }
 
+File::File(FileRecord &r)
+    : fs(r.fs), file(r.file), r(&r)
+{
+}
+
 File &File::operator=(const path &rhs)
 {
     file = rhs;
@@ -98,14 +106,16 @@ std::unordered_set<std::shared_ptr<sw::builder::Command>> File::gatherDependentG
 {
     registerSelf();
     std::unordered_set<std::shared_ptr<sw::builder::Command>> deps;
-    for (auto &[f, d] : r->explicit_dependencies)
+    for (auto id : r->explicit_dependencies)
     {
-        if (d->isGenerated())
+        auto d = fs->getFileRecord(id);
+        if (d && d->isGenerated())
             deps.insert(d->getGenerator());
     }
-    for (auto &[f, d] : r->implicit_dependencies)
+    for (auto id : r->implicit_dependencies)
     {
-        if (d->isGenerated())
+        auto d = fs->getFileRecord(id);
+        if (d && d->isGenerated())
             deps.insert(d->getGenerator());
     }
     return deps;
@@ -116,22 +126,113 @@ path File::getPath() const
     return file;
 }
 
+namespace
+{
+
+// Dependency lists of a record are modified under one of these locks,
+// selected by record id, so independent records do not wait for each other.
+struct DependencyLocks
+{
+    static constexpr size_t n_shards = 64;
+
+    struct alignas(64) shard
+    {
+        std::mutex m;
+        std::atomic<uint64_t> acquisitions{ 0 };
+        std::atomic<uint64_t> contentions{ 0 };
+    };
+
+    std::array<shard, n_shards> shards;
+
+    std::unique_lock<std::mutex> lock(PathId id)
+    {
+        auto &s = shards[id % n_shards];
+        s.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lk(s.m, std::try_to_lock);
+        if (!lk.owns_lock())
+        {
+            s.contentions.fetch_add(1, std::memory_order_relaxed);
+            lk.lock();
+        }
+        return lk;
+    }
+
+    DependencyLockStats getStats() const
+    {
+        DependencyLockStats st;
+        for (auto &s : shards)
+        {
+            st.acquisitions += s.acquisitions;
+            st.contentions += s.contentions;
+        }
+        return st;
+    }
+};
+
+}
+
+static DependencyLocks &getDependencyLocks()
+{
+    static DependencyLocks locks;
+    return locks;
+}
+
+DependencyLockStats getDependencyLockStats()
+{
+    return getDependencyLocks().getStats();
+}
+
+static void addDependencies(FileStorage &fs, FileRecord &r, PathIdSet FileRecord::*deps, const std::vector<PathId> &ids)
+{
+    if (ids.empty())
+        return;
+
+    bool inserted = false;
+    {
+        auto lk = getDependencyLocks().lock(r.id);
+        for (auto id : ids)
+            inserted |= (r.*deps).insert(id);
+    }
+    if (inserted)
+        fs.invalidateMaxTimes();
+}
+
+static void addDependencies(FileStorage &fs, FileRecord &r, PathIdSet FileRecord::*deps, const Files &files)
+{
+    // register files outside of the lock
+    std::vector<PathId> ids;
+    ids.reserve(files.size());
+    for (auto &p : files)
+    {
+        if (p.empty())
+            continue;
+        ids.push_back(File(p, fs).getFileRecord().id);
+    }
+    addDependencies(fs, r, deps, ids);
+}
+
 void File::addExplicitDependency(const path &p)
 {
     if (p.empty())
         return;
     registerSelf();
-    File f(p, *fs);
-    // FIXME:
-    static std::mutex m;
-    std::unique_lock<std::mutex> lk(m);
-    r->explicit_dependencies.emplace(p, f.r);
+    addDependencies(*fs, *r, &FileRecord::explicit_dependencies, { p });
 }
 
 void File::addExplicitDependency(const Files &files)
 {
-    for (auto &p : files)
-        addExplicitDependency(p);
+    registerSelf();
+    addDependencies(*fs, *r, &FileRecord::explicit_dependencies, files);
+}
+
+void File::addExplicitDependency(const std::vector<FileRecord *> &records)
+{
+    registerSelf();
+    std::vector<PathId> ids;
+    ids.reserve(records.size());
+    for (auto d : records)
+        ids.push_back(d->id);
+    addDependencies(*fs, *r, &FileRecord::explicit_dependencies, ids);
 }
 
 void File::addImplicitDependency(const path &p)
@@ -139,30 +240,34 @@ void File::addImplicitDependency(const path &p)
     if (p.empty())
         return;
     registerSelf();
-    File f(p, *fs);
-    // FIXME:
-    static std::mutex m;
-    std::unique_lock<std::mutex> lk(m);
-    r->implicit_dependencies.emplace(p, f.r);
+    addDependencies(*fs, *r, &FileRecord::implicit_dependencies, { p });
 }
 
 void File::addImplicitDependency(const Files &files)
 {
-    for (auto &p : files)
-        addImplicitDependency(p);
+    registerSelf();
+    addDependencies(*fs, *r, &FileRecord::implicit_dependencies, files);
 }
 
 void File::clearDependencies()
 {
     registerSelf();
-    r->explicit_dependencies.clear();
-    r->implicit_dependencies.clear();
+    {
+        auto lk = getDependencyLocks().lock(r->id);
+        r->explicit_dependencies.clear();
+        r->implicit_dependencies.clear();
+    }
+    fs->invalidateMaxTimes();
 }
 
 void File::clearImplicitDependencies()
 {
     registerSelf();
-    r->implicit_dependencies.clear();
+    {
+        auto lk = getDependencyLocks().lock(r->id);
+        r->implicit_dependencies.clear();
+    }
+    fs->invalidateMaxTimes();
 }
 
 FileRecord &File::getFileRecord()
@@ -230,6 +335,7 @@ FileRecord &FileRecord::operator=(const FileRecord &rhs)
         fs = rhs.fs;
 
     file = rhs.file;
+    id = rhs.id;
     data = rhs.data;
 
     generator = rhs.generator;
@@ -245,10 +351,16 @@ size_t FileRecord::getHash() const
     auto k = std::hash<path>()(file);
     hash_combine(k, data->last_write_time.time_since_epoch().count());
     //hash_combine(k, size);
-    for (auto &[f, d] : explicit_dependencies)
-        hash_combine(k, d->data->last_write_time.time_since_epoch().count());
-    for (auto &[f, d] : implicit_dependencies)
-        hash_combine(k, d->data->last_write_time.time_since_epoch().count());
+    for (auto id : explicit_dependencies)
+    {
+        if (auto d = fs->getFileRecord(id); d && d->data)
+            hash_combine(k, d->data->last_write_time.time_since_epoch().count());
+    }
+    for (auto id : implicit_dependencies)
+    {
+        if (auto d = fs->getFileRecord(id); d && d->data)
+            hash_combine(k, d->data->last_write_time.time_since_epoch().count());
+    }
     return k;
 }
 
@@ -276,22 +388,28 @@ void FileRecord::load(const path &p)
     auto lwt = fs::last_write_time(file);
     if (lwt < data->last_write_time)
         return;
+    // store before invalidation, so new generation never sees the old time
+    auto changed = lwt != data->last_write_time;
     data->last_write_time = lwt;
+    if (changed)
+        fs->invalidateMaxTimes();
     //size = fs::file_size(file);
     // do not calc hashes on the first run
     // we do this on the first mismatch
     //hash = sha256(file);
 
     // also update deps
-    for (auto &[f, d] : explicit_dependencies)
+    for (auto id : explicit_dependencies)
     {
+        auto d = fs->getFileRecord(id);
         if (d == this || !d)
             continue;
         if (d->isChanged())
             d->load();
     }
-    for (auto &[f, d] : implicit_dependencies)
+    for (auto id : implicit_dependencies)
     {
+        auto d = fs->getFileRecord(id);
         if (d == this || !d)
             continue;
         if (d->isChanged())
@@ -311,15 +429,17 @@ bool FileRecord::refresh(bool use_file_monitor)
 
     // in any case refresh *all* deps
     // do it first, because we might exit early
-    for (auto &[f, d] : explicit_dependencies)
+    for (auto id : explicit_dependencies)
     {
-        if (d == this)
+        auto d = fs->getFileRecord(id);
+        if (d == this || !d)
             continue;
         d->refresh(use_file_monitor);
     }
-    for (auto &[f, d] : implicit_dependencies)
+    for (auto id : implicit_dependencies)
     {
-        if (d == this)
+        auto d = fs->getFileRecord(id);
+        if (d == this || !d)
             continue;
         d->refresh(use_file_monitor);
     }
@@ -344,6 +464,7 @@ bool FileRecord::refresh(bool use_file_monitor)
         else
             EXPLAIN_OUTDATED("file", true, "empty last_write_time", file.u8string());
         data->last_write_time = t;
+        fs->invalidateMaxTimes();
         result = true;
     }
 
@@ -368,6 +489,7 @@ bool FileRecord::isChanged(bool use_file_monitor)
             std::to_string(data->last_write_time.time_since_epoch().count()) + " to " +
             std::to_string(t.time_since_epoch().count()), file.u8string());
         data->last_write_time = t;
+        fs->invalidateMaxTimes();
         c = true;
     }
 
@@ -413,44 +535,138 @@ bool FileRecord::isGenerated() const
 
 fs::file_time_type FileRecord::getMaxTime() const
 {
-    std::unordered_set<FileData*> files;
-    return getMaxTime1(files);
+    const auto g = fs->getMaxTimeGeneration();
+    fs::file_time_type::rep t;
+    if (getCachedMaxTime(g, t))
+        return fs::file_time_type(fs::file_time_type::duration(t));
+    return computeMaxTime(g);
 }
 
-fs::file_time_type FileRecord::getMaxTime1(std::unordered_set<FileData*> &files) const
+bool FileRecord::getCachedMaxTime(uint64_t generation, fs::file_time_type::rep &t) const
 {
-    auto m = data->last_write_time;
-    for (auto &[f, d] : explicit_dependencies)
+    auto s = max_time_seq.load();
+    if (s & 1)
+        return false;
+    if (max_time_generation != generation)
+        return false;
+    t = max_time;
+    // pair is consistent only if there was no write in between
+    return max_time_seq == s;
+}
+
+void FileRecord::setCachedMaxTime(uint64_t generation, fs::file_time_type::rep t) const
+{
+    // value of a concurrent writer or of a newer generation is kept, memo is skipped then
+    auto s = max_time_seq.load();
+    if ((s & 1) || max_time_generation > generation)
+        return;
+    if (!max_time_seq.compare_exchange_strong(s, s + 1))
+        return;
+    max_time_generation = generation;
+    max_time = t;
+    max_time_seq = s + 2;
+}
+
+fs::file_time_type FileRecord::computeMaxTime(uint64_t generation) const
+{
+    // Iterative Tarjan's SCC walk over explicit + implicit deps.
+    // Mutually including headers form a single component and share its max time.
+    // Every finished component is published into records,
+    // so other roots (possibly from other threads) reuse it.
+    // Concurrent walks may compute the same component twice, results are equal.
+    using rep = fs::file_time_type::rep;
+
+    struct node
     {
-        if (d == this)
-            continue;
-        if (files.find(d->data) != files.end() || !d->data)
+        size_t index;
+        size_t lowlink;
+        rep max;
+        bool on_stack;
+    };
+
+    std::unordered_map<const FileRecord *, node> nodes;
+    std::vector<const FileRecord *> stack;
+    std::vector<std::pair<const FileRecord *, size_t>> calls;
+
+    // dependency 'd' of 'r' brings max time 't'
+    auto update = [](const FileRecord *r, node &n, const FileRecord *d, rep t, bool explicit_dep)
+    {
+        if (t <= n.max)
+            return;
+        n.max = t;
+        EXPLAIN_OUTDATED("file", true, String(explicit_dep ? "explicit " : "implicit ") + d->file.u8string() + " is newer", r->file.u8string());
+    };
+
+    auto visit = [&nodes, &stack, &calls](const FileRecord *r)
+    {
+        auto i = nodes.size();
+        nodes[r] = { i, i, r->data->last_write_time.time_since_epoch().count(), true };
+        stack.push_back(r);
+        calls.emplace_back(r, 0);
+    };
+
+    visit(this);
+    while (!calls.empty())
+    {
+        auto [r, i] = calls.back();
+        auto ne = r->explicit_dependencies.size();
+        if (i < ne + r->implicit_dependencies.size())
+        {
+            calls.back().second++;
+            auto id = i < ne ? r->explicit_dependencies[i] : r->implicit_dependencies[i - ne];
+            auto d = fs->getFileRecord(id);
+            if (!d || d == r || !d->data)
+                continue;
+            auto &n = nodes[r];
+            rep t;
+            if (d->getCachedMaxTime(generation, t))
+            {
+                update(r, n, d, t, i < ne);
+                continue;
+            }
+            auto it = nodes.find(d);
+            if (it == nodes.end())
+            {
+                visit(d);
+                continue;
+            }
+            // finished components are already published, so 'd' is on stack here
+            if (it->second.on_stack)
+                n.lowlink = std::min(n.lowlink, it->second.index);
+            else
+                update(r, n, d, it->second.max, i < ne);
             continue;
-        files.insert(d->data);
-        //auto dm = d->data->last_write_time;
-        auto dm = d->getMaxTime1(files);
-        if (dm > m)
+        }
+
+        calls.pop_back();
+        auto &n = nodes[r];
+        if (n.lowlink == n.index)
         {
-            m = dm;
-            EXPLAIN_OUTDATED("file", true, "explicit " + f.u8string() + " is newer", file.u8string());
+            // component root, gather max of all members and publish
+            auto m = n.max;
+            auto b = std::find(stack.rbegin(), stack.rend(), r).base() - 1;
+            for (auto j = b; j != stack.end(); j++)
+                m = std::max(m, nodes[*j].max);
+            for (auto j = b; j != stack.end(); j++)
+            {
+                auto &c = nodes[*j];
+                c.max = m;
+                c.on_stack = false;
+                (*j)->setCachedMaxTime(generation, m);
+            }
+            stack.erase(b, stack.end());
         }
-    }
-    for (auto &[f, d] : implicit_dependencies)
-    {
-        if (d == this)
-            continue;
-        if (files.find(d->data) != files.end() || !d->data)
-            continue;
-        files.insert(d->data);
-        //auto dm = d->data->last_write_time;
-        auto dm = d->getMaxTime1(files);
-        if (dm > m)
+
+        if (!calls.empty())
         {
-            m = dm;
-            EXPLAIN_OUTDATED("file", true, "implicit " + f.u8string() + " is newer", file.u8string());
+            auto [pr, pi] = calls.back();
+            auto &p = nodes[pr];
+            p.lowlink = std::min(p.lowlink, n.lowlink);
+            update(pr, p, r, n.max, pi - 1 < pr->explicit_dependencies.size());
         }
     }
-    return m;
+
+    return fs::file_time_type(fs::file_time_type::duration(nodes[this].max));
 }
 
 fs::file_time_type FileRecord::updateLwt()
@@ -464,9 +680,10 @@ fs::file_time_type FileRecord::updateLwt1(std::unordered_set<FileData*> &files)
     if (data->last_write_time.time_since_epoch().count() == 0)
         const_cast<FileRecord*>(this)->load(file);
     auto m = data->last_write_time;
-    for (auto &[f, d] : explicit_dependencies)
+    for (auto id : explicit_dependencies)
     {
-        if (d == this)
+        auto d = fs->getFileRecord(id);
+        if (d == this || !d)
             continue;
         if (files.find(d->data) != files.end() || !d->data)
             continue;
@@ -475,9 +692,10 @@ fs::file_time_type FileRecord::updateLwt1(std::unordered_set<FileData*> &files)
         if (dm > m)
             m = dm;
     }
-    for (auto &[f, d] : implicit_dependencies)
+    for (auto id : implicit_dependencies)
     {
-        if (d == this)
+        auto d = fs->getFileRecord(id);
+        if (d == this || !d)
             continue;
         if (files.find(d->data) != files.end() || !d->data)
             continue;
@@ -486,7 +704,11 @@ fs::file_time_type FileRecord::updateLwt1(std::unordered_set<FileData*> &files)
         if (dm > m)
             m = dm;
     }
-    data->last_write_time = m;
+    if (data->last_write_time != m)
+    {
+        data->last_write_time = m;
+        fs->invalidateMaxTimes();
+    }
     return m;
 }
 
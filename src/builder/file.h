@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "path_table.h"
+
 #include <enums.h>
 #include <node.h>
 
@@ -36,6 +38,8 @@ struct SW_BUILDER_API File : virtual Node
     File() = default;
     File(FileStorage &s);
     File(const path &p, FileStorage &s);
+    /// wraps already registered record, no path lookups are performed
+    File(FileRecord &r);
     virtual ~File() = default;
 
     File &operator=(const path &rhs);
@@ -43,6 +47,7 @@ struct SW_BUILDER_API File : virtual Node
     path getPath() const;
     void addExplicitDependency(const path &f);
     void addExplicitDependency(const Files &f);
+    void addExplicitDependency(const std::vector<FileRecord *> &f);
     void addImplicitDependency(const path &f);
     void addImplicitDependency(const Files &f);
     void clearDependencies();
@@ -92,11 +97,11 @@ struct SW_BUILDER_API FileRecord
     FileStorage *fs = nullptr;
 
     path file;
+    PathId id = 0;
     FileData *data = nullptr;
 
-    // make sets?
-    std::unordered_map<path, FileRecord *> explicit_dependencies;
-    std::unordered_map<path, FileRecord *> implicit_dependencies;
+    PathIdSet explicit_dependencies;
+    PathIdSet implicit_dependencies;
 
     FileRecord() = default;
     FileRecord(const FileRecord &);
@@ -119,6 +124,7 @@ struct SW_BUILDER_API FileRecord
     std::atomic_bool saved{ false };
 
     /// get last write time of this file and all deps
+    /// result is memoized until the storage's max time generation changes
     fs::file_time_type getMaxTime() const;
 
     /// returns true if file was changed
@@ -130,12 +136,30 @@ private:
     std::weak_ptr<builder::Command> generator;
     bool generated_ = false;
 
-    fs::file_time_type getMaxTime1(std::unordered_set<FileData*> &files) const;
+    // memoized max time, valid when generation matches storage's one
+    // the pair is guarded by the sequence counter, odd value means write in progress
+    mutable std::atomic<uint64_t> max_time_seq{ 0 };
+    mutable std::atomic<fs::file_time_type::rep> max_time{ 0 };
+    mutable std::atomic<uint64_t> max_time_generation{ 0 };
+
+    bool getCachedMaxTime(uint64_t generation, fs::file_time_type::rep &t) const;
+    void setCachedMaxTime(uint64_t generation, fs::file_time_type::rep t) const;
+    fs::file_time_type computeMaxTime(uint64_t generation) const;
     fs::file_time_type updateLwt1(std::unordered_set<FileData*> &files);
 };
 
 path getFilesLogFileName(const String &config = {});
 
+struct DependencyLockStats
+{
+    uint64_t acquisitions = 0;
+    uint64_t contentions = 0;
+};
+
+/// contention metrics of dependency insertion locks
+SW_BUILDER_API
+DependencyLockStats getDependencyLockStats();
+
 #define EXPLAIN_OUTDATED(subject, outdated, reason, name) \
     explainMessage(subject, outdated, reason, name)
 
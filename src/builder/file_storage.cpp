@@ -53,9 +53,27 @@ ConcurrentHashMap<path, FileData> &getFileData()
     return file_data;
 }
 
+static std::atomic<uint64_t> &getMaxTimeGenerationCounter()
+{
+    // lives next to file data, because last write times are global
+    static std::atomic<uint64_t> generation{ 1 };
+    return generation;
+}
+
+uint64_t FileStorage::getMaxTimeGeneration()
+{
+    return getMaxTimeGenerationCounter();
+}
+
+void FileStorage::invalidateMaxTimes()
+{
+    ++getMaxTimeGenerationCounter();
+}
+
 std::map<String, FileStorage> &getFileStorages()
 {
     getFileData();
+    getMaxTimeGenerationCounter();
 
     static std::map<String, FileStorage> fs;
     return fs;
@@ -121,6 +139,9 @@ void FileStorage::load()
         auto &f = *i.getValue();
         f.fs = this;
     }
+
+    // loaded times are merged into global file data
+    invalidateMaxTimes();
 }
 
 void FileStorage::save()
@@ -140,6 +161,7 @@ void FileStorage::reset()
         auto &f = *i.getValue();
         f.reset();
     }
+    invalidateMaxTimes();
 }
 
 FileRecord *FileStorage::registerFile(const File &in_f)
@@ -149,56 +171,65 @@ FileRecord *FileStorage::registerFile(const File &in_f)
     // very slow
     //((File*)&in_f)->file = boost::to_lower_copy(normalize_path(in_f.file));
     ((File*)&in_f)->file = normalize_path(in_f.file);
+    const auto &p = in_f.file;
+#else
+    // key records by the same path that is interned
+    path p = normalize_path(in_f.file);
 #endif
 
-    auto d = getFileData().insert(in_f.file);
-    auto r = files.insert(in_f.file);
-    if (r.second)
-    {
-        //r.first->load(in_f.file);
-        /*if (!in_f.file.empty())
-            r.first->data->file = in_f.file;*/
-    }
-    //else
-        //r.first->isChanged();
-    in_f.r = r.first;
-    r.first->data = d.first;
-    r.first->fs = this;
-    //if (d.second || d.first->last_write_time.time_since_epoch().count() == 0)
-        //r.first->load(in_f.file);
-
-    /*if (d.second)
-    {
-        DEBUG_BREAK_IF_PATH_HAS(in_f.file, "sdir/bison/src/system.h");
-        r.first->load(in_f.file);
-    }*/
-
-    if (useFileMonitor)
-    {
-        get_file_monitor().addFile(in_f.file, [this](const path &f)
-        {
-            auto &r = File(f, *this).getFileRecord();
-            error_code ec;
-            if (fs::exists(r.file, ec))
-                r.data->last_write_time = fs::last_write_time(f);
-            else
-                r.data->refreshed = false;
-        });
-    }
-
-    return r.first;
+    auto r = registerFile(getPathTable().intern(p), p);
+    in_f.r = r;
+    return r;
 }
 
 FileRecord *FileStorage::registerFile(const path &in_f)
 {
-    auto p = normalize_path(in_f);
-    auto r = files.insert(p);
-    r.first->fs = this;
+    path p = normalize_path(in_f);
+    return registerFile(getPathTable().intern(p), p);
+}
+
+FileRecord *FileStorage::registerFile(PathId id, const path &p)
+{
+    // fast path: path is already known to this storage
+    if (auto r = records.get(id))
+        return r;
+
+    // slow path is serialized, so the record is initialized
+    // and its monitor is added only by the winning thread
+    std::unique_lock<std::mutex> lk(register_mutex);
+    if (auto r = records.get(id))
+        return r;
+
     auto d = getFileData().insert(p);
+    auto r = files.insert(p);
+    if (r.first->file.empty())
+        r.first->file = p;
+    r.first->id = id;
     r.first->data = d.first;
+    r.first->fs = this;
+    records.set(id, r.first);
     //if (!d.first)
         //throw std::runtime_error("Cannot create file data for file: " + in_f.u8string());
+
+    addFileMonitor(p);
     return r.first;
 }
 
+void FileStorage::addFileMonitor(const path &p)
+{
+    // monitor is added once, when record is created, both registration paths must do it
+    if (!useFileMonitor)
+        return;
+    get_file_monitor().addFile(p, [this](const path &f)
+    {
+        auto &r = File(f, *this).getFileRecord();
+        error_code ec;
+        if (fs::exists(r.file, ec))
+            r.data->last_write_time = fs::last_write_time(f);
+        else
+            r.data->refreshed = false;
+        invalidateMaxTimes();
+    });
+}
+
 }
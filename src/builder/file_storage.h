@@ -9,6 +9,8 @@
 #include "concurrent_map.h"
 #include "file.h"
 
+#include <mutex>
+
 namespace sw
 {
 
@@ -38,12 +40,26 @@ struct SW_BUILDER_API FileStorage
     FileRecord *registerFile(const File &f);
     FileRecord *registerFile(const path &f);
 
+    /// returns nullptr if file with such id is not registered in this storage
+    FileRecord *getFileRecord(PathId id) const { return records.get(id); }
+
+    /// generation of memoized max times
+    /// it is bumped on every change of file times or dependency edges;
+    /// file times are shared by all storages, so the generation is global too
+    static uint64_t getMaxTimeGeneration();
+    static void invalidateMaxTimes();
+
     void async_file_log(const FileRecord *r);
 
 private:
     std::unique_ptr<file_holder> async_log;
+    PathIdMap<FileRecord> records;
+
+    std::mutex register_mutex;
 
     file_holder *getLog();
+    FileRecord *registerFile(PathId id, const path &p);
+    void addFileMonitor(const path &p);
 };
 
 SW_BUILDER_API
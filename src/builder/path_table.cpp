@@ -0,0 +1,81 @@
+// Copyright (C) 2017-2018 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "path_table.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace sw
+{
+
+PathTable &getPathTable()
+{
+    static PathTable t;
+    return t;
+}
+
+PathId PathTable::intern(const path &p)
+{
+    StringView v = p.native();
+    {
+        std::shared_lock lk(m);
+        auto i = ids.find(v);
+        if (i != ids.end())
+            return i->second;
+    }
+
+    std::unique_lock lk(m);
+    auto i = ids.find(v);
+    if (i != ids.end())
+        return i->second;
+    // id = 0 is reserved
+    if (paths.size() + 1 >= max_id)
+        throw std::runtime_error("Too many paths in path table");
+    auto &s = paths.emplace_back(p);
+    auto id = (PathId)paths.size();
+    ids.emplace(StringView(s.native()), id);
+    return id;
+}
+
+PathId PathTable::find(const path &p) const
+{
+    std::shared_lock lk(m);
+    auto i = ids.find(p.native());
+    if (i == ids.end())
+        return 0;
+    return i->second;
+}
+
+const path &PathTable::get(PathId id) const
+{
+    std::shared_lock lk(m);
+    if (id == 0 || id > paths.size())
+        throw std::runtime_error("Bad path id: " + std::to_string(id));
+    return paths[id - 1];
+}
+
+size_t PathTable::size() const
+{
+    std::shared_lock lk(m);
+    return paths.size();
+}
+
+bool PathIdSet::insert(PathId id)
+{
+    auto i = std::lower_bound(ids.begin(), ids.end(), id);
+    if (i != ids.end() && *i == id)
+        return false;
+    ids.insert(i, id);
+    return true;
+}
+
+bool PathIdSet::contains(PathId id) const
+{
+    return std::binary_search(ids.begin(), ids.end(), id);
+}
+
+}
@@ -0,0 +1,127 @@
+// Copyright (C) 2017-2018 Egor Pugin <egor.pugin@gmail.com>
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <platform.h>
+
+#include <primitives/filesystem.h>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sw
+{
+
+/// stable 32-bit id of a normalized path, zero is invalid
+using PathId = uint32_t;
+
+/// global path interning table
+/// each path is stored only once, ids are never reused during the process lifetime
+struct SW_BUILDER_API PathTable
+{
+    static constexpr PathId max_id = 1 << 24;
+
+    PathTable() = default;
+    PathTable(const PathTable &) = delete;
+    PathTable &operator=(const PathTable &) = delete;
+
+    /// input path must be already normalized
+    PathId intern(const path &p);
+    /// returns zero if path is unknown
+    PathId find(const path &p) const;
+    const path &get(PathId id) const;
+    size_t size() const;
+
+private:
+    using StringView = std::basic_string_view<path::value_type>;
+
+    mutable std::shared_mutex m;
+    // arena, deque keeps references stable, so views below are always valid
+    std::deque<path> paths;
+    std::unordered_map<StringView, PathId> ids;
+};
+
+SW_BUILDER_API
+PathTable &getPathTable();
+
+/// sorted set of path ids, 4 bytes per edge
+struct SW_BUILDER_API PathIdSet
+{
+    using container = std::vector<PathId>;
+
+    /// returns true on insertion
+    bool insert(PathId id);
+    bool contains(PathId id) const;
+    void clear() { ids.clear(); }
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    PathId operator[](size_t i) const { return ids[i]; }
+
+    auto begin() const { return ids.begin(); }
+    auto end() const { return ids.end(); }
+
+private:
+    container ids;
+};
+
+/// lock-free lookup table from path id to value pointer
+/// pages are allocated on demand and never moved
+template <class V>
+struct PathIdMap
+{
+    static constexpr size_t page_bits = 12;
+    static constexpr size_t page_size = 1 << page_bits;
+    static constexpr size_t n_pages = PathTable::max_id / page_size;
+
+    PathIdMap() = default;
+    PathIdMap(const PathIdMap &) = delete;
+    PathIdMap &operator=(const PathIdMap &) = delete;
+
+    ~PathIdMap()
+    {
+        for (auto &p : pages)
+            delete[] p.load();
+    }
+
+    V *get(PathId id) const
+    {
+        if (id >= PathTable::max_id)
+            return nullptr;
+        auto p = pages[id >> page_bits].load(std::memory_order_acquire);
+        if (!p)
+            return nullptr;
+        return p[id & (page_size - 1)].load(std::memory_order_acquire);
+    }
+
+    void set(PathId id, V *v)
+    {
+        if (id == 0 || id >= PathTable::max_id)
+            throw std::runtime_error("PathIdMap: bad id: " + std::to_string(id));
+        auto &slot = pages[id >> page_bits];
+        auto p = slot.load(std::memory_order_acquire);
+        if (!p)
+        {
+            auto np = new std::atomic<V *>[page_size]();
+            if (slot.compare_exchange_strong(p, np, std::memory_order_acq_rel))
+                p = np;
+            else
+                delete[] np;
+        }
+        p[id & (page_size - 1)].store(v, std::memory_order_release);
+    }
+
+private:
+    std::array<std::atomic<std::atomic<V *> *>, n_pages> pages{};
+};
+
+}
@@ -8,22 +8,26 @@
 
 #include <checks_storage.h>
 #include <db.h>
+#include <directories.h>
 #include <solution.h>
 
 #include <filesystem.h>
 #include <hash.h>
 
 #include <boost/algorithm/string.hpp>
+#include <primitives/context.h>
+#include <primitives/lock.h>
+#include <primitives/sw/settings.h>
+
+#include <mutex>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "checks");
 
-namespace
-{
+#define CHECKS_CACHE_FORMAT_VERSION 1
 
-bool bSilentChecks = true;
-
-}
+static cl::opt<bool> do_not_batch_checks("do-not-batch-checks", cl::desc("Build every check separately"));
+static cl::opt<bool> do_not_use_checks_cache("do-not-use-checks-cache", cl::desc("Do not use user wide cache of check results"));
 
 namespace sw
 {
@@ -198,11 +202,449 @@ bool Check::isChecked() const
     });
 }
 
+static const int value_marker_digits = 10;
+
+/// global array holding decimal digits of a constant expression,
+/// it is found in the object file by its name, so nothing is run
+static String make_value_marker(const String &name, const String &expr)
+{
+    String s = "char " + name + "[] = { 'I', 'N', 'F', 'O', ':'";
+    for (auto c : name)
+        s += ", '"s + c + "'";
+    s += ", '['";
+    String d = "1";
+    for (int i = 1; i < value_marker_digits; i++)
+        d += "0";
+    for (int i = 0; i < value_marker_digits; i++)
+    {
+        s += ", (char)('0' + ((" + expr + ") / " + d + "ULL) % 10)";
+        d.pop_back();
+    }
+    s += ", ']', 0 };\n";
+    return s;
+}
+
+static std::optional<int> read_value_marker(const String &object, const String &name)
+{
+    auto m = "INFO:" + name + "[";
+    auto p = object.find(m);
+    if (p == object.npos)
+        return {};
+    p += m.size();
+    if (p + value_marker_digits >= object.size() || object[p + value_marker_digits] != ']')
+        return {};
+    int v = 0;
+    for (int i = 0; i < value_marker_digits; i++)
+    {
+        auto c = object[p + i];
+        if (c < '0' || c > '9')
+            return {};
+        v = v * 10 + (c - '0');
+    }
+    return v;
+}
+
+/// builds check sources with the detected compiler and linker directly,
+/// without solution copies, targets and execution plans
+struct CheckProgram
+{
+    DefinitionsType Definitions;
+    FilesOrdered LinkLibraries;
+
+    CheckProgram(const Check &c, const String &src)
+        : s(*c.checker->solution)
+    {
+        d = s.getChecksDir() / unique_path();
+        ::create_directories(d);
+        f = d;
+        if (!c.CPP)
+            f /= "x.c";
+        else
+            f /= "x.cpp";
+        write_file(f, src);
+    }
+
+    bool compile()
+    {
+        auto c = std::dynamic_pointer_cast<NativeCompiler>(s.findProgramByExtension(f.extension().string())->clone());
+        if (!c)
+            return false;
+        c->NativeCompilerOptions::add(Definitions);
+        o = f;
+        o += c->getObjectExtension();
+        c->setSourceFile(f, o);
+        return execute(c->getCommand());
+    }
+
+    bool link()
+    {
+        if (!compile())
+            return false;
+        auto L = std::dynamic_pointer_cast<NativeLinker>(s.Settings.Native.Linker->clone());
+        if (!L)
+            return false;
+        for (auto &l : LinkLibraries)
+            L->NativeLinkerOptions::LinkLibraries.push_back(l);
+        L->setObjectFiles({ o });
+        L->setOutputFile(d / "x");
+        e = L->getOutputFile();
+        return execute(L->getCommand());
+    }
+
+    const path &getObjectFile() const { return o; }
+
+    /// returns exit code of the linked program
+    int run() const
+    {
+        std::error_code ec;
+        primitives::Command c;
+        c.program = e;
+        c.execute(ec);
+        if (c.exit_code)
+            return c.exit_code.value();
+        return 0;
+    }
+
+private:
+    const Solution &s;
+    path d;
+    path f;
+    path o;
+    path e;
+
+    static bool execute(const std::shared_ptr<builder::Command> &c)
+    {
+        if (!c)
+            return false;
+        std::error_code ec;
+        c->execute(ec);
+        return c->exit_code && c->exit_code.value() == 0;
+    }
+};
+
+/// user wide cache of check results shared by all solutions and projects,
+/// new results are merged into the file under lock, so concurrent processes do not lose them
+struct GlobalChecksCache
+{
+    ~GlobalChecksCache()
+    {
+        try
+        {
+            save();
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR(logger, "Error during checks cache save: " << e.what());
+        }
+    }
+
+    std::optional<int> find(const String &k)
+    {
+        std::call_once(loaded, [this] { load(); });
+
+        std::shared_lock lk(m);
+        auto i = values.find(k);
+        if (i == values.end())
+            return {};
+        return i->second;
+    }
+
+    void add(const String &k, int v)
+    {
+        std::call_once(loaded, [this] { load(); });
+
+        std::unique_lock lk(m);
+        values[k] = v;
+        added[k] = v;
+    }
+
+private:
+    std::shared_mutex m;
+    std::unordered_map<String, int> values;
+    std::unordered_map<String, int> added;
+    std::once_flag loaded;
+    path fn;
+
+    static void read(const path &fn, std::unordered_map<String, int> &values)
+    {
+        primitives::BinaryContext b;
+        try
+        {
+            b.load(fn);
+        }
+        catch (std::exception &)
+        {
+            if (fs::exists(fn))
+                LOG_WARN(logger, "Cannot load checks cache: " << fn.u8string());
+            return;
+        }
+        while (!b.eof())
+        {
+            String k;
+            int v;
+            b.read(k);
+            b.read(v);
+            values[k] = v;
+        }
+    }
+
+    void load()
+    {
+        fn = getUserDirectories().storage_dir_tmp / "db";
+        fn += "." + std::to_string(CHECKS_CACHE_FORMAT_VERSION) + ".checks";
+
+        ScopedShareableFileLock lk(fn);
+        read(fn, values);
+    }
+
+    void save() const
+    {
+        if (added.empty() || fn.empty())
+            return;
+
+        ScopedFileLock lk(fn);
+
+        // take results of other processes
+        std::unordered_map<String, int> all;
+        read(fn, all);
+        for (auto &[k, v] : added)
+            all[k] = v;
+
+        primitives::BinaryContext b(all.size() * 72);
+        for (auto &[k, v] : all)
+        {
+            b.write(k);
+            b.write(v);
+        }
+        b.save(fn);
+    }
+};
+
+static GlobalChecksCache &getGlobalChecksCache()
+{
+    static GlobalChecksCache cache;
+    return cache;
+}
+
+static String getToolchainKey(const Solution &s, bool cpp)
+{
+    String k = s.getConfig();
+    auto add_program = [&k](const Program *p)
+    {
+        if (!p)
+            return;
+        std::error_code ec;
+        auto t = fs::last_write_time(p->file, ec);
+        k += ";" + normalize_path(p->file) + ";" + p->getVersion().toString() + ";" + std::to_string(t.time_since_epoch().count());
+    };
+    add_program(s.findProgramByExtension(cpp ? ".cpp" : ".c"));
+    add_program(s.Settings.Native.Linker.get());
+
+    // the same programs give other results with other system dirs
+    if (auto c = dynamic_cast<const NativeCompiler *>(s.findProgramByExtension(cpp ? ".cpp" : ".c")))
+    {
+        for (auto &d : c->System.gatherIncludeDirectories())
+            k += ";I:" + normalize_path(d);
+    }
+    if (auto &l = s.Settings.Native.Linker)
+    {
+        for (auto &d : l->System.gatherLinkDirectories())
+            k += ";L:" + normalize_path(d);
+    }
+    for (auto v : { "INCLUDE", "LIB", "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "LIBRARY_PATH" })
+    {
+        if (auto e = getenv(v))
+            k += ";" + String(v) + "=" + e;
+    }
+    return k;
+}
+
+bool Check::loadValue() const
+{
+    if (has_value)
+        return true;
+    // batches have no data and are never cached
+    if (do_not_use_checks_cache || data.empty())
+        return false;
+    auto v = getGlobalChecksCache().find(getCacheKey());
+    if (!v)
+        return false;
+    Value = *v;
+    has_value = true;
+    return true;
+}
+
+void Check::saveValue() const
+{
+    if (do_not_use_checks_cache || data.empty())
+        return;
+    getGlobalChecksCache().add(getCacheKey(), Value);
+}
+
+String Check::getCacheKey() const
+{
+    String k = getToolchainKey(*checker->solution, CPP);
+    // the same compiler may build both languages
+    k += CPP ? ";cpp" : ";c";
+    k += ";";
+    k += typeid(*this).name();
+    k += ";" + data;
+    for (auto &i : Parameters.Includes)
+        k += ";i:" + i;
+    for (auto &[d, v] : Parameters.Definitions)
+        k += ";d:" + d + "=" + v;
+    for (auto &i : Parameters.IncludeDirectories)
+        k += ";I:" + normalize_path(i);
+    for (auto &l : Parameters.Libraries)
+        k += ";l:" + normalize_path(l);
+    for (auto &o : Parameters.Options)
+        k += ";o:" + o;
+    return sha256(k);
+}
+
 void Check::execute()
 {
-    if (isChecked())
+    if (isChecked() || loadValue())
         return;
     run();
+    saveValue();
+}
+
+/// builds several independent checks in one executable
+struct CheckBatch : Check
+{
+    std::vector<Check *> checks;
+
+    void run() const override
+    {
+        run(checks);
+    }
+
+private:
+    // with many failures bisection needs more builds than running checks one by one
+    static constexpr size_t min_resolved = 8;
+    static constexpr double max_failure_ratio = 0.25;
+
+    mutable size_t resolved = 0;
+    mutable size_t failed = 0;
+
+    void run(const std::vector<Check *> &v) const
+    {
+        std::vector<int> values;
+        if (build(v, values))
+        {
+            for (size_t i = 0; i < v.size(); i++)
+                setValue(*v[i], values[i]);
+            resolved += v.size();
+            return;
+        }
+        // single failed check has the same result as its own run
+        if (v.size() == 1)
+        {
+            setValue(*v[0], 0);
+            resolved++;
+            failed++;
+            return;
+        }
+        // the rest is run on its own as usual
+        if (resolved >= min_resolved && failed > resolved * max_failure_ratio)
+            return;
+        auto m = v.begin() + v.size() / 2;
+        run({ v.begin(), m });
+        run({ m, v.end() });
+    }
+
+    static void setValue(Check &c, int value)
+    {
+        c.Value = value;
+        c.has_value = true;
+        c.saveValue();
+    }
+
+    bool build(const std::vector<Check *> &v, std::vector<int> &values) const
+    {
+        String src;
+        // function checks do not use includes
+        if (!dynamic_cast<const FunctionExists *>(v[0]))
+        {
+            for (auto &d : v[0]->Parameters.Includes)
+            {
+                auto c = checker->add<IncludeExists>(d);
+                if (c->Value)
+                    src += "#include <" + d + ">\n";
+            }
+        }
+
+        if (v[0]->isCompileOnly())
+        {
+            for (size_t i = 0; i < v.size(); i++)
+                src += "\n" + v[i]->getBatchSource("check_" + std::to_string(i));
+
+            CheckProgram p(*this, src);
+            if (!p.compile())
+                return false;
+            auto o = read_file(p.getObjectFile());
+            for (size_t i = 0; i < v.size(); i++)
+            {
+                auto r = read_value_marker(o, "check_" + std::to_string(i));
+                if (!r)
+                    return false;
+                values.push_back(*r);
+            }
+            return true;
+        }
+
+        String main = "int main(int argc, char **argv)\n{\n  int r = 0;\n  (void)argv;\n";
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            auto fn = "check_" + std::to_string(i);
+            src += "\n" + v[i]->getBatchSource(fn);
+            main += "  r += " + fn + "(argc);\n";
+        }
+        src += "\n" + main + "  return r;\n}\n";
+
+        CheckProgram p(*this, src);
+        if (!p.link())
+            return false;
+        values.assign(v.size(), 1);
+        return true;
+    }
+};
+
+void Checker::createBatches(const std::unordered_set<std::shared_ptr<Check>> &checks)
+{
+    if (do_not_batch_checks)
+        return;
+
+    std::map<String, std::vector<std::shared_ptr<Check>>> groups;
+    for (auto &c : checks)
+    {
+        if (!c->isBatchable() || c->loadValue())
+            continue;
+        String k = typeid(*c).name();
+        k += c->CPP ? " cpp" : " c";
+        for (auto &i : c->Parameters.Includes)
+            k += " " + i;
+        groups[k].push_back(c);
+    }
+
+    int n = 0;
+    for (auto &[k, v] : groups)
+    {
+        if (v.size() < 2)
+            continue;
+        auto b = std::make_shared<CheckBatch>();
+        b->checker = this;
+        b->CPP = v[0]->CPP;
+        b->Definition = "BATCH_" + std::to_string(n++);
+        for (auto &c : v)
+        {
+            b->checks.push_back(c.get());
+            b->dependencies.insert(c->dependencies.begin(), c->dependencies.end());
+        }
+        for (auto &c : v)
+            c->dependencies.insert(b);
+    }
 }
 
 void Check::updateDependencies()
@@ -225,6 +667,22 @@ FunctionExists::FunctionExists(const String &f, const String &def)
     check_def(Definition);
 }
 
+String FunctionExists::getBatchSource(const String &fn) const
+{
+    return R"(#ifdef __cplusplus
+extern "C"
+#endif
+  char
+  )" + data + R"((void);
+int )" + fn + R"((int argc)
+{
+  (void)argc;
+  )" + data + R"(();
+  return 0;
+}
+)";
+}
+
 void FunctionExists::run() const
 {
     static const String src{ R"(
@@ -251,40 +709,9 @@ int main(int ac, char* av[])
 )"
     };
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    e.Definitions["CHECK_FUNCTION_EXISTS"] = data;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd && cmd->exit_code)
-            Value = cmd->exit_code.value() == 0 ? 1 : 0;
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, src);
+    p.Definitions["CHECK_FUNCTION_EXISTS"] = data;
+    Value = p.link() ? 1 : 0;
 }
 
 IncludeExists::IncludeExists(const String &i, const String &def)
@@ -326,26 +753,8 @@ int main()
 }
 )";
 
-    auto d = checker->solution->getChecksDir();
-    d /= unique_path();
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-    auto c = std::dynamic_pointer_cast<NativeCompiler>(checker->solution->findProgramByExtension(f.extension().string())->clone());
-    auto o = f;
-    c->setSourceFile(f, o += ".obj");
-
-    std::error_code ec;
-    auto cmd = c->getCommand();
-    cmd->execute(ec);
-    if (cmd && cmd->exit_code)
-        Value = cmd->exit_code.value() == 0 ? 1 : 0;
-    else
-        Value = 0;
+    CheckProgram p(*this, src);
+    Value = p.compile() ? 1 : 0;
 }
 
 TypeSize::TypeSize(const String &t, const String &def)
@@ -373,6 +782,11 @@ void TypeSize::init()
         Parameters.Includes.push_back(h);
 }
 
+String TypeSize::getBatchSource(const String &fn) const
+{
+    return make_value_marker(fn, "sizeof(" + data + ")");
+}
+
 void TypeSize::run() const
 {
     String src;
@@ -382,50 +796,13 @@ void TypeSize::run() const
         if (c->Value)
             src += "#include <" + d + ">\n";
     }
-    src += "int main() { return sizeof(" + data + "); }";
+    src += getBatchSource("check");
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
+    CheckProgram p(*this, src);
+    if (p.compile())
+        Value = read_value_marker(read_file(p.getObjectFile()), "check").value_or(0);
     else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd)
-        {
-            std::error_code ec;
-            primitives::Command c;
-            c.program = e.getOutputFile();
-            c.execute(ec);
-            if (c.exit_code)
-                Value = c.exit_code.value();
-            else
-                Value = 0;
-        }
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
         Value = 0;
-    }
 }
 
 TypeAlignment::TypeAlignment(const String &t, const String &def)
@@ -448,6 +825,13 @@ void TypeAlignment::init()
         Parameters.Includes.push_back(h);
 }
 
+String TypeAlignment::getBatchSource(const String &fn) const
+{
+    // b is placed right after padding, and sizeof is a multiple of alignment
+    return "struct " + fn + "_s { char a; " + data + " b; };\n" +
+        make_value_marker(fn, "sizeof(struct " + fn + "_s) - sizeof(" + data + ")");
+}
+
 void TypeAlignment::run() const
 {
     String src;
@@ -457,59 +841,13 @@ void TypeAlignment::run() const
         if (c->Value)
             src += "#include <" + d + ">\n";
     }
-    src += R"(
-int main()
-{
-    char diff;
-    struct foo {char a; )" + data + R"( b;};
-    struct foo *p = (struct foo *) malloc(sizeof(struct foo));
-    diff = ((char *)&p->b) - ((char *)&p->a);
-    return diff;
-}
-)";
+    src += getBatchSource("check");
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
+    CheckProgram p(*this, src);
+    if (p.compile())
+        Value = read_value_marker(read_file(p.getObjectFile()), "check").value_or(0);
     else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd)
-        {
-            std::error_code ec;
-            primitives::Command c;
-            c.program = e.getOutputFile();
-            c.execute(ec);
-            if (c.exit_code)
-                Value = c.exit_code.value();
-            else
-                Value = 0;
-        }
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
         Value = 0;
-    }
 }
 
 SymbolExists::SymbolExists(const String &s, const String &def)
@@ -526,6 +864,20 @@ SymbolExists::SymbolExists(const String &s, const String &def)
     check_def(Definition);
 }
 
+String SymbolExists::getBatchSource(const String &fn) const
+{
+    return R"(int )" + fn + R"((int argc)
+{
+#ifndef )" + data + R"(
+  return ((int*)(&)" + data + R"())[argc];
+#else
+  (void)argc;
+  return 0;
+#endif
+}
+)";
+}
+
 void SymbolExists::run() const
 {
     String src;
@@ -548,39 +900,8 @@ int main(int argc, char** argv)
 }
 )";
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        /*auto cmd = e.getCommand();
-        if (cmd && cmd->exit_code)
-            Value = cmd->exit_code.value() == 0 ? 1 : 0;
-        else*/
-        Value = 1;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, src);
+    Value = p.link() ? 1 : 0;
 }
 
 DeclarationExists::DeclarationExists(const String &d, const String &def)
@@ -613,6 +934,11 @@ void DeclarationExists::init()
         Parameters.Includes.push_back(h);
 }
 
+String DeclarationExists::getBatchSource(const String &fn) const
+{
+    return "int " + fn + "(int argc) { (void)argc; (void)" + data + "; return 0; }\n";
+}
+
 void DeclarationExists::run() const
 {
     String src;
@@ -624,39 +950,8 @@ void DeclarationExists::run() const
     }
     src += "int main() { (void)" + data + "; return 0; }";
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd && cmd->exit_code)
-            Value = cmd->exit_code.value() == 0 ? 1 : 0;
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, src);
+    Value = p.link() ? 1 : 0;
 }
 
 StructMemberExists::StructMemberExists(const String &s, const String &member, const String &def)
@@ -674,6 +969,11 @@ StructMemberExists::StructMemberExists(const String &s, const String &member, co
     check_def(Definition);
 }
 
+String StructMemberExists::getBatchSource(const String &fn) const
+{
+    return "int " + fn + "(int argc) { (void)argc; (void)sizeof(((" + s + " *)0)->" + member + "); return 0; }\n";
+}
+
 void StructMemberExists::run() const
 {
     String src;
@@ -685,39 +985,8 @@ void StructMemberExists::run() const
     }
     src += "int main() { sizeof(((" + s + " *)0)->" + member + "); return 0; }";
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd && cmd->exit_code)
-            Value = cmd->exit_code.value() == 0 ? 1 : 0;
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, src);
+    Value = p.link() ? 1 : 0;
 }
 
 LibraryFunctionExists::LibraryFunctionExists(const String &library, const String &function, const String &def)
@@ -761,41 +1030,10 @@ int main(int ac, char* av[])
 )"
     };
 
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, src);
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    e.Definitions["CHECK_FUNCTION_EXISTS"] = data;
-    e.LinkLibraries.push_back(library);
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd && cmd->exit_code)
-            Value = cmd->exit_code.value() == 0 ? 1 : 0;
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, src);
+    p.Definitions["CHECK_FUNCTION_EXISTS"] = data;
+    p.LinkLibraries.push_back(library);
+    Value = p.link() ? 1 : 0;
 }
 
 SourceCompiles::SourceCompiles(const String &def, const String &source)
@@ -809,26 +1047,8 @@ SourceCompiles::SourceCompiles(const String &def, const String &source)
 
 void SourceCompiles::run() const
 {
-    auto d = checker->solution->getChecksDir();
-    d /= unique_path();
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, data);
-    auto c = std::dynamic_pointer_cast<NativeCompiler>(checker->solution->findProgramByExtension(f.extension().string())->clone());
-    auto o = f;
-    c->setSourceFile(f, o += ".obj");
-
-    std::error_code ec;
-    auto cmd = c->getCommand();
-    cmd->execute(ec);
-    if (cmd && cmd->exit_code)
-        Value = cmd->exit_code.value() == 0 ? 1 : 0;
-    else
-        Value = 0;
+    CheckProgram p(*this, data);
+    Value = p.compile() ? 1 : 0;
 }
 
 SourceLinks::SourceLinks(const String &def, const String &source)
@@ -842,35 +1062,8 @@ SourceLinks::SourceLinks(const String &def, const String &source)
 
 void SourceLinks::run() const
 {
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, data);
-    auto c = std::dynamic_pointer_cast<NativeCompiler>(checker->solution->findProgramByExtension(f.extension().string())->clone());
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-        Value = 1;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, data);
+    Value = p.link() ? 1 : 0;
 }
 
 SourceRuns::SourceRuns(const String &def, const String &source)
@@ -884,49 +1077,8 @@ SourceRuns::SourceRuns(const String &def, const String &source)
 
 void SourceRuns::run() const
 {
-    auto d = checker->solution->getChecksDir();
-    auto up = unique_path();
-    d /= up;
-    ::create_directories(d);
-    auto f = d;
-    if (!CPP)
-        f /= "x.c";
-    else
-        f /= "x.cpp";
-    write_file(f, data);
-    auto c = std::dynamic_pointer_cast<NativeCompiler>(checker->solution->findProgramByExtension(f.extension().string())->clone());
-
-    auto s = *checker->solution;
-    s.silent = bSilentChecks;
-    //s.throw_exceptions = false;
-    s.BinaryDir = d;
-
-    auto &e = s.addTarget<ExecutableTarget>(up.string());
-    e += f;
-    s.prepare();
-    try
-    {
-        s.execute();
-
-        auto cmd = e.getCommand();
-        if (cmd)
-        {
-            std::error_code ec;
-            primitives::Command c;
-            c.program = e.getOutputFile();
-            c.execute(ec);
-            if (c.exit_code)
-                Value = c.exit_code.value();
-            else
-                Value = 0;
-        }
-        else
-            Value = 0;
-    }
-    catch (...)
-    {
-        Value = 0;
-    }
+    CheckProgram p(*this, data);
+    Value = p.link() ? p.run() : 0;
 }
 
 FunctionExists &CheckSet::checkFunctionExists(const String &function, LanguageType L)
@@ -10,6 +10,7 @@
 #include "types.h"
 
 #include <unordered_map>
+#include <unordered_set>
 
 // native
 
@@ -87,6 +88,13 @@ struct SW_DRIVER_CPP_API Check : CommandData<Check>
     virtual void init() {}
     // for comparison
     virtual size_t getHash() const { return 0; }
+    /// check is only built, so it can share one executable with similar checks
+    virtual bool isBatchable() const { return false; }
+    /// code of the check as function 'int fn(int argc)' for a batch
+    /// or as value marker 'fn' for compile only checks
+    virtual String getBatchSource(const String &fn) const { return {}; }
+    /// value is read from the object file, nothing is linked or run
+    virtual bool isCompileOnly() const { return false; }
     bool isChecked() const;
     void updateDependencies();
     void execute() override;
@@ -96,6 +104,18 @@ struct SW_DRIVER_CPP_API Check : CommandData<Check>
 
 protected:
     virtual void run() const {}
+
+private:
+    // value is set by successful batch or taken from global cache
+    mutable bool has_value = false;
+
+    /// looks for the value in the user wide cache of check results
+    bool loadValue() const;
+    void saveValue() const;
+    /// toolchain, settings and check parameters
+    String getCacheKey() const;
+
+    friend struct CheckBatch;
 };
 
 using Checks = std::unordered_map<String, std::shared_ptr<Check>>;
@@ -104,6 +124,8 @@ struct SW_DRIVER_CPP_API FunctionExists : Check
 {
     FunctionExists(const String &f, const String &def = "");
 
+    bool isBatchable() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -119,6 +141,9 @@ struct SW_DRIVER_CPP_API TypeSize : Check
     TypeSize(const String &t, const String &def = "");
 
     void init() override;
+    bool isBatchable() const override { return true; }
+    bool isCompileOnly() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -127,6 +152,9 @@ struct SW_DRIVER_CPP_API TypeAlignment : Check
     TypeAlignment(const String &t, const String &def = "");
 
     void init() override;
+    bool isBatchable() const override { return true; }
+    bool isCompileOnly() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -136,6 +164,8 @@ struct SW_DRIVER_CPP_API SymbolExists : Check
 {
     SymbolExists(const String &s, const String &def = "");
 
+    bool isBatchable() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -144,6 +174,8 @@ struct SW_DRIVER_CPP_API DeclarationExists : Check
     DeclarationExists(const String &d, const String &def = "");
 
     void init() override;
+    bool isBatchable() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -154,6 +186,8 @@ struct SW_DRIVER_CPP_API StructMemberExists : Check
 
     StructMemberExists(const String &s, const String &member, const String &def = "");
 
+    bool isBatchable() const override { return true; }
+    String getBatchSource(const String &fn) const override;
     void run() const override;
 };
 
@@ -250,6 +284,10 @@ struct SW_DRIVER_CPP_API Checker : CheckSet
         p.first->second.checker = this;
         return p.first->second;
     }
+
+    /// groups batchable checks with equal parameters,
+    /// each group is built once before its checks, failed groups are split
+    void createBatches(const std::unordered_set<std::shared_ptr<Check>> &checks);
 };
 
 template <class T, class ... Args>
@@ -129,6 +129,7 @@ void VSCommand::postProcess(bool)
     for (auto &f : outputs)
         File(f, *fs).clearImplicitDependencies();*/
 
+    Files includes;
     for (auto &line : lines)
     {
         auto p = line.find(pattern);
@@ -140,11 +141,15 @@ void VSCommand::postProcess(bool)
         auto include = line.substr(pattern.size());
         boost::trim(include);
         //file.addImplicitDependency(include);
-        for (auto &f : intermediate)
-            File(f, *fs).addImplicitDependency(include);
-        for (auto &f : outputs)
-            File(f, *fs).addImplicitDependency(include);
+        includes.insert(include);
     }
+
+    // add all at once, so every file record is locked only once
+    auto &r = getFileRecords();
+    for (auto f : r.intermediate)
+        File(*f).addImplicitDependency(includes);
+    for (auto f : r.outputs)
+        File(*f).addImplicitDependency(includes);
 }
 
 void GNUCommand::postProcess(bool ok)
@@ -158,6 +163,7 @@ void GNUCommand::postProcess(bool ok)
 
     auto lines = read_lines(deps_file);
     //file.clearImplicitDependencies();
+    Files includes;
     for (auto i = lines.begin() + 1; i != lines.end(); i++)
     {
         auto &s = *i;
@@ -173,12 +179,17 @@ void GNUCommand::postProcess(bool ok)
 
         for (auto &f2 : files)
         {
-            for (auto &f : intermediate)
-                File(f, *fs).addImplicitDependency(f2);
-            for (auto &f : outputs)
-                File(f, *fs).addImplicitDependency(f2);
+            if (!f2.empty())
+                includes.insert(f2);
         }
     }
+
+    // add all at once, so every file record is locked only once
+    auto &r = getFileRecords();
+    for (auto f : r.intermediate)
+        File(*f).addImplicitDependency(includes);
+    for (auto f : r.outputs)
+        File(*f).addImplicitDependency(includes);
 }
 
 ///
@@ -402,8 +413,8 @@ void ExecuteBuiltinCommand::execute()
     call();
 
     // force outputs update
-    for (auto &o : outputs)
-        File(o, *fs).getFileRecord().load();
+    for (auto f : getFileRecords().outputs)
+        f->load();
 }
 
 }
@@ -292,6 +292,15 @@ private:
     bool dependency_set = false;
 };
 
+/// joins dependency edges of many commands, does nothing itself
+/// all barriers look the same, so they must not be merged as duplicates
+struct SW_DRIVER_CPP_API BarrierCommand : _ExecuteCommand
+{
+    using _ExecuteCommand::_ExecuteCommand;
+
+    bool isHashable() const override { return false; }
+};
+
 struct SW_DRIVER_CPP_API ExecuteBuiltinCommand : builder::Command
 {
     using F = std::function<void(void)>;
@@ -15,9 +15,15 @@
 #include <misc/cmVSSetupHelper.h>
 #endif
 
+#include <directories.h>
+
 #include <boost/algorithm/string.hpp>
+#include <primitives/context.h>
+#include <primitives/lock.h>
 
+#include <mutex>
 #include <regex>
+#include <shared_mutex>
 #include <string>
 
 #include <primitives/log.h>
@@ -30,13 +36,224 @@ DECLARE_STATIC_LOGGER(logger, "compiler");
 #define SW_MAKE_COMPILER_COMMAND_WITH_FILE(t) \
     SW_MAKE_COMPILER_COMMAND(driver::cpp::t)
 
+#define TOOLCHAIN_CACHE_FORMAT_VERSION 2
+
 static cl::opt<bool> do_not_resolve_compiler("do-not-resolve-compiler");
+static cl::opt<bool> do_not_use_toolchain_cache("do-not-use-toolchain-cache", cl::desc("Detect compiler paths and versions on every run"));
 
 #define CPP_EXTS ".cpp", ".cxx", ".c++", ".cc", ".CPP", ".C++", ".CXX", ".C", ".CC"
 
 namespace sw
 {
 
+/// persistent cache of resolved program paths and program versions
+/// entries are checked with a single stat of the program, so known toolchains are detected
+/// without PATH lookups and without spawning compilers
+/// new entries are merged into the file under lock, so concurrent processes do not lose them
+struct ToolchainCache
+{
+    ~ToolchainCache()
+    {
+        try
+        {
+            save();
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR(logger, "Error during toolchain cache save: " << e.what());
+        }
+    }
+
+    path resolve(const path &p)
+    {
+        auto e = getenv("PATH");
+        String env = e ? e : "";
+        auto k = "r:" + p.u8string() + "\n" + env;
+        // program added to any PATH directory may take precedence over the cached one
+        auto dirs = getDirectoriesStamp(env);
+        if (auto v = find(k, dirs))
+            return fs::u8path(*v);
+        auto r = primitives::resolve_executable(p);
+        add(k, r, r.u8string(), dirs);
+        return r;
+    }
+
+    template <class F>
+    Version getVersion(const String &kind, const path &program, F &&gather)
+    {
+        auto k = "v:" + kind + ":" + normalize_path(program);
+        if (auto v = find(k))
+            return Version(*v);
+        auto v = gather();
+        add(k, program, v.toString());
+        return v;
+    }
+
+private:
+    struct Entry
+    {
+        String value;
+        // stat of the program
+        String file;
+        uintmax_t size = 0;
+        fs::file_time_type::rep mtime = 0;
+        // modification times of searched directories
+        size_t dirs = 0;
+    };
+
+    std::shared_mutex m;
+    std::unordered_map<String, Entry> entries;
+    std::unordered_map<String, Entry> added;
+    std::once_flag loaded;
+    path fn;
+
+    static void stat(const path &f, uintmax_t &size, fs::file_time_type::rep &mtime)
+    {
+        std::error_code ec;
+        size = fs::file_size(f, ec);
+        if (ec)
+            size = 0;
+        mtime = fs::last_write_time(f, ec).time_since_epoch().count();
+        if (ec)
+            mtime = 0;
+    }
+
+    static size_t getDirectoriesStamp(const String &env)
+    {
+#ifdef _WIN32
+        const auto delim = ';';
+#else
+        const auto delim = ':';
+#endif
+        String s;
+        size_t b = 0;
+        while (b <= env.size())
+        {
+            auto e = env.find(delim, b);
+            if (e == env.npos)
+                e = env.size();
+            if (e != b)
+            {
+                std::error_code ec;
+                auto t = fs::last_write_time(fs::u8path(env.substr(b, e - b)), ec);
+                s += std::to_string(ec ? 0 : t.time_since_epoch().count()) + ";";
+            }
+            b = e + 1;
+        }
+        return std::hash<String>()(s);
+    }
+
+    std::optional<String> find(const String &k, size_t dirs = 0)
+    {
+        if (do_not_use_toolchain_cache)
+            return {};
+        std::call_once(loaded, [this] { load(); });
+
+        Entry e;
+        {
+            std::shared_lock lk(m);
+            auto i = entries.find(k);
+            if (i == entries.end())
+                return {};
+            e = i->second;
+        }
+        if (e.dirs != dirs)
+            return {};
+        uintmax_t size;
+        fs::file_time_type::rep mtime;
+        stat(fs::u8path(e.file), size, mtime);
+        if (size != e.size || mtime != e.mtime)
+            return {};
+        return e.value;
+    }
+
+    void add(const String &k, const path &file, const String &value, size_t dirs = 0)
+    {
+        // not found programs are not cached
+        if (do_not_use_toolchain_cache || file.empty())
+            return;
+        std::call_once(loaded, [this] { load(); });
+
+        Entry e;
+        e.value = value;
+        e.file = file.u8string();
+        stat(file, e.size, e.mtime);
+        e.dirs = dirs;
+
+        std::unique_lock lk(m);
+        entries[k] = e;
+        added[k] = e;
+    }
+
+    static void read(const path &fn, std::unordered_map<String, Entry> &entries)
+    {
+        primitives::BinaryContext b;
+        try
+        {
+            b.load(fn);
+        }
+        catch (std::exception &)
+        {
+            if (fs::exists(fn))
+                LOG_WARN(logger, "Cannot load toolchain cache: " << fn.u8string());
+            return;
+        }
+        while (!b.eof())
+        {
+            String k;
+            Entry e;
+            b.read(k);
+            b.read(e.value);
+            b.read(e.file);
+            b.read(e.size);
+            b.read(e.mtime);
+            b.read(e.dirs);
+            entries[k] = e;
+        }
+    }
+
+    void load()
+    {
+        fn = getUserDirectories().storage_dir_tmp / "db";
+        fn += "." + std::to_string(TOOLCHAIN_CACHE_FORMAT_VERSION) + ".toolchains";
+
+        ScopedShareableFileLock lk(fn);
+        read(fn, entries);
+    }
+
+    void save() const
+    {
+        if (added.empty() || fn.empty())
+            return;
+
+        ScopedFileLock lk(fn);
+
+        // take entries of other processes
+        std::unordered_map<String, Entry> all;
+        read(fn, all);
+        for (auto &[k, e] : added)
+            all[k] = e;
+
+        primitives::BinaryContext b(all.size() * 256);
+        for (auto &[k, e] : all)
+        {
+            b.write(k);
+            b.write(e.value);
+            b.write(e.file);
+            b.write(e.size);
+            b.write(e.mtime);
+            b.write(e.dirs);
+        }
+        b.save(fn);
+    }
+};
+
+static ToolchainCache &getToolchainCache()
+{
+    static ToolchainCache cache;
+    return cache;
+}
+
 std::string getVsToolset(VisualStudioVersion v)
 {
     switch (v)
@@ -495,7 +712,7 @@ void detectNativeCompilers(struct Solution &s)
     {
         if (do_not_resolve_compiler)
             return p;
-        return primitives::resolve_executable(p);
+        return getToolchainCache().resolve(p);
     };
 
     p = resolve("ar");
@@ -644,28 +861,54 @@ ToolBase::~ToolBase()
     //delete cmd;
 }
 
+void NativeCompiler::merge(const std::shared_ptr<const NativeCompilerOptions> &o, const std::shared_ptr<const Strings> &args)
+{
+    if (InheritedOptions)
+        NativeCompilerOptions::merge(*InheritedOptions);
+    InheritedOptions = o;
+    InheritedArgs = args;
+}
+
+void NativeCompiler::eraseIncludeDirectories(const Files &dirs)
+{
+    merge(nullptr);
+    for (auto &d : dirs)
+        IncludeDirectories.erase(d);
+}
+
+void NativeCompiler::addCompileOptions(builder::Command &c) const
+{
+    // target options are rendered once and shared, only own options are rendered here
+    if (InheritedArgs && InheritedOptions && addEverything(c, *InheritedOptions, InheritedArgs))
+        return;
+    addEverything(c, InheritedOptions.get());
+}
+
 Version VisualStudio::gatherVersion(const path &program) const
 {
-    Version V;
-    primitives::Command c;
-    c.program = program;
-    c.args = { "--version" };
-    std::error_code ec;
-    c.execute(ec);
-    // ms returns exit code = 2 on --version
-    if (ec)
-    {
-        static std::regex r("(\\d+)\\.(\\d+)\\.(\\d+)(\\.(\\d+))?");
-        std::smatch m;
-        if (std::regex_search(c.err.text.empty() ? c.out.text : c.err.text, m, r))
+    return getToolchainCache().getVersion("msvc", program, [&program]
+    {
+        Version V;
+        primitives::Command c;
+        c.program = program;
+        c.args = { "--version" };
+        std::error_code ec;
+        c.execute(ec);
+        // ms returns exit code = 2 on --version
+        if (ec)
         {
-            if (m[5].matched)
-                V = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()), std::stoi(m[5].str()) };
-            else
-                V = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
+            static std::regex r("(\\d+)\\.(\\d+)\\.(\\d+)(\\.(\\d+))?");
+            std::smatch m;
+            if (std::regex_search(c.err.text.empty() ? c.out.text : c.err.text, m, r))
+            {
+                if (m[5].matched)
+                    V = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()), std::stoi(m[5].str()) };
+                else
+                    V = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
+            }
         }
-    }
-    return V;
+        return V;
+    });
 }
 
 std::shared_ptr<builder::Command> VisualStudioASMCompiler::getCommand() const
@@ -694,7 +937,7 @@ std::shared_ptr<builder::Command> VisualStudioASMCompiler::getCommand() const
     c->base = clone();
 
     getCommandLineOptions<VisualStudioAssemblerOptions>(c.get(), *this);
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
 
     return cmd = c;
 }
@@ -757,7 +1000,7 @@ std::shared_ptr<builder::Command> VisualStudioCompiler::getCommand() const
     c->base = clone();
 
     getCommandLineOptions<VisualStudioCompilerOptions>(c.get(), *this);
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
 
     if (PreprocessToFile)
     {
@@ -793,20 +1036,23 @@ void VisualStudioCompiler::setSourceFile(const path &input_file, path &output_fi
 
 Version Clang::gatherVersion(const path &program) const
 {
-    Version v;
-    primitives::Command c;
-    c.program = program;
-    c.args = {"-v"};
-    std::error_code ec;
-    c.execute(ec);
-    if (!ec)
-    {
-        static std::regex r("^clang version (\\d+).(\\d+).(\\d+)");
-        std::smatch m;
-        if (std::regex_search(c.err.text, m, r))
-            v = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
-    }
-    return v;
+    return getToolchainCache().getVersion("clang", program, [&program]
+    {
+        Version v;
+        primitives::Command c;
+        c.program = program;
+        c.args = {"-v"};
+        std::error_code ec;
+        c.execute(ec);
+        if (!ec)
+        {
+            static std::regex r("^clang version (\\d+).(\\d+).(\\d+)");
+            std::smatch m;
+            if (std::regex_search(c.err.text, m, r))
+                v = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
+        }
+        return v;
+    });
 }
 
 std::shared_ptr<builder::Command> ClangCompiler::getCommand() const
@@ -835,7 +1081,7 @@ std::shared_ptr<builder::Command> ClangCompiler::getCommand() const
     c->base = clone();
 
     getCommandLineOptions<ClangOptions>(c.get(), *this);
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
 
     return cmd = c;
 }
@@ -900,7 +1146,7 @@ std::shared_ptr<builder::Command> ClangClCompiler::getCommand() const
 
     getCommandLineOptions<VisualStudioCompilerOptions>(c.get(), *this);
     getCommandLineOptions<ClangClOptions>(c.get(), *this, "-Xclang");
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
 
     return cmd = c;
 }
@@ -930,20 +1176,23 @@ void ClangClCompiler::setSourceFile(const path &input_file, path &output_file)
 
 Version GNU::gatherVersion(const path &program) const
 {
-    Version v;
-    primitives::Command c;
-    c.program = program;
-    c.args = { "-v" };
-    std::error_code ec;
-    c.execute(ec);
-    if (!ec)
-    {
-        static std::regex r("(\\d+).(\\d+).(\\d+)");
-        std::smatch m;
-        if (std::regex_search(c.err.text, m, r))
-            v = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
-    }
-    return v;
+    return getToolchainCache().getVersion("gnu", program, [&program]
+    {
+        Version v;
+        primitives::Command c;
+        c.program = program;
+        c.args = { "-v" };
+        std::error_code ec;
+        c.execute(ec);
+        if (!ec)
+        {
+            static std::regex r("(\\d+).(\\d+).(\\d+)");
+            std::smatch m;
+            if (std::regex_search(c.err.text, m, r))
+                v = { std::stoi(m[1].str()), std::stoi(m[2].str()), std::stoi(m[3].str()) };
+        }
+        return v;
+    });
 }
 
 std::shared_ptr<builder::Command> GNUASMCompiler::getCommand() const
@@ -969,7 +1218,7 @@ std::shared_ptr<builder::Command> GNUASMCompiler::getCommand() const
     c->base = clone();
 
     getCommandLineOptions<GNUAssemblerOptions>(c.get(), *this);
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
 
     return cmd = c;
 }
@@ -1028,7 +1277,7 @@ std::shared_ptr<builder::Command> GNUCompiler::getCommand() const
     c->base = clone();
 
     getCommandLineOptions<GNUOptions>(c.get(), *this);
-    iterate([c](auto &v, auto &gs) { v.addEverything(*c); });
+    addCompileOptions(*c);
     getCommandLineOptions<GNUOptions>(c.get(), *this, "", true);
 
     return cmd = c;
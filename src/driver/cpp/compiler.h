@@ -80,14 +80,30 @@ struct SW_DRIVER_CPP_API NativeCompiler : Compiler,
 {
     CompilerType Type = CompilerType::UnspecifiedCompiler;
 
+    /// target options shared by all its files instead of copying them into every compiler
+    std::shared_ptr<const NativeCompilerOptions> InheritedOptions;
+    /// InheritedOptions rendered once, referenced by commands of files without own options
+    std::shared_ptr<const Strings> InheritedArgs;
+
     virtual ~NativeCompiler() = default;
 
+    using NativeCompilerOptions::merge;
+
+    /// reference target options, previously referenced ones are copied into ours
+    void merge(const std::shared_ptr<const NativeCompilerOptions> &o, const std::shared_ptr<const Strings> &args = {});
+    /// removes include dirs from own and referenced target options
+    /// target options are copied into this compiler then, other files still share them
+    void eraseIncludeDirectories(const Files &dirs);
+
     virtual void setSourceFile(const path &input_file, path &output_file) = 0;
     virtual String getObjectExtension() const { return ".o"; }
     virtual Files getGeneratedDirs() const = 0;
 
 protected:
     mutable Files dependencies;
+
+    /// adds own and inherited definitions, include dirs and compile options
+    void addCompileOptions(builder::Command &c) const;
 };
 
 struct SW_DRIVER_CPP_API VisualStudio : CompilerToolBase
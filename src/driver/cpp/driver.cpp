@@ -86,9 +86,12 @@ bool CppDriver::execute(const path &file_or_dir) const
         return {};
     current_thread_path(f.value().parent_path());
 
-    if (auto s = load(f.value()); s)
-        return s->execute();
-    return false;
+    auto b = std::make_unique<Build>();
+    b->Local = true;
+    b->configure = true;
+    b->use_snapshot = true;
+    b->build_and_load(f.value());
+    return b->execute();
 }
 
 static auto fetch1(const CppDriver *driver, const path &file_or_dir, bool parallel)
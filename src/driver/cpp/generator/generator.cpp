@@ -1161,7 +1161,7 @@ struct NinjaContext : primitives::Context
         addText(prepareString(b, getShortName(prog), true) + " ");
         if (!rsp)
         {
-            for (auto &a : c->args)
+            for (auto &a : c->getArguments())
             {
                 addText(prepareString(b, a, true) + " ");
                 has_mmd |= "-MMD" == a;
@@ -1185,7 +1185,7 @@ struct NinjaContext : primitives::Context
         {
             addLine("rspfile = " + rsp_file.u8string());
             addLine("rspfile_content = ");
-            for (auto &a : c->args)
+            for (auto &a : c->getArguments())
                 addText(prepareString(b, a, true) + " ");
         }
         decreaseIndent();
@@ -38,7 +38,7 @@ FileRegex::FileRegex(const String &fn, bool recursive)
         p = fn.find_first_of("/*?+[.\\", p);
         if (p == -1 || fn[p] != '/')
         {
-            r = fn.substr(p0);
+            compile(fn.substr(p0));
             return;
         }
 
@@ -56,7 +56,7 @@ FileRegex::FileRegex(const String &fn, bool recursive)
 
         if (s.find_first_of("*?+.[](){}") != -1)
         {
-            r = fn.substr(p0);
+            compile(fn.substr(p0));
             return;
         }
 
@@ -74,6 +74,125 @@ FileRegex::FileRegex(const path &dir, const std::regex &r, bool recursive)
 {
 }
 
+void FileRegex::compile(const String &pattern)
+{
+    r = pattern;
+
+    // split pattern into atoms, keep only plain characters as literals
+    struct Atom
+    {
+        char c;
+        bool literal;
+    };
+    std::vector<Atom> atoms;
+    int depth = 0;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        auto c = pattern[i];
+        switch (c)
+        {
+        case '\\':
+            if (++i == pattern.size())
+                return;
+            c = pattern[i];
+            // \d, \w, \b etc.
+            atoms.push_back({ c, !isalnum((unsigned char)c) });
+            break;
+        case '[':
+        {
+            auto j = i + 1;
+            if (j < pattern.size() && pattern[j] == '^')
+                j++;
+            if (j < pattern.size() && pattern[j] == ']')
+                j++;
+            for (; j < pattern.size() && pattern[j] != ']'; j++)
+            {
+                if (pattern[j] == '\\')
+                    j++;
+            }
+            if (j >= pattern.size())
+                return;
+            i = j;
+            atoms.push_back({ c, false });
+            break;
+        }
+        case '|':
+            // top level alternatives have no common literal parts
+            if (depth == 0)
+                return;
+            atoms.push_back({ c, false });
+            break;
+        case '(':
+            depth++;
+            atoms.push_back({ c, false });
+            break;
+        case ')':
+            depth--;
+            atoms.push_back({ c, false });
+            break;
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            // quantified atom is not a literal anymore
+            if (!atoms.empty() && atoms.back().literal)
+                atoms.back() = { 0, false };
+            if (c == '{')
+            {
+                i = pattern.find('}', i);
+                if (i == pattern.npos)
+                    return;
+            }
+            atoms.push_back({ c, false });
+            break;
+        case '.':
+        case '^':
+        case '$':
+            atoms.push_back({ c, false });
+            break;
+        default:
+            atoms.push_back({ c, true });
+            break;
+        }
+    }
+
+    auto b = atoms.begin();
+    for (; b != atoms.end() && b->literal; b++)
+        prefix += b->c;
+    if (b == atoms.end())
+    {
+        kind = Literal;
+        return;
+    }
+    auto e = atoms.end();
+    for (; e != b && (e - 1)->literal; e--)
+        ;
+    for (auto i = e; i != atoms.end(); i++)
+        suffix += i->c;
+    if (e - b == 2 && b->c == '.' && (b + 1)->c == '*')
+        kind = PrefixAnySuffix;
+}
+
+bool FileRegex::match(const String &s) const
+{
+    switch (kind)
+    {
+    case Literal:
+        return s == prefix;
+    default:
+        if (s.size() < prefix.size() + suffix.size() ||
+            s.compare(0, prefix.size(), prefix) != 0 ||
+            s.compare(s.size() - suffix.size(), suffix.size(), suffix) != 0)
+            return false;
+        // '.' does not match line terminators
+        if (kind == PrefixAnySuffix &&
+            s.find_first_of("\r\n", prefix.size()) >= s.size() - suffix.size())
+            return true;
+        break;
+    }
+    return std::regex_match(s, r);
+}
+
 template <class C>
 void unique_merge_containers(C &to, const C &from)
 {
@@ -212,12 +331,18 @@ void NativeCompilerOptionsData::remove(const DefinitionsType &defs)
         Definitions.erase(k);
 }
 
-PathOptionsType NativeCompilerOptionsData::gatherIncludeDirectories() const
+PathOptionsType NativeCompilerOptionsData::gatherIncludeDirectories(const NativeCompilerOptionsData *inherited) const
 {
     PathOptionsType d;
     d.insert(PreIncludeDirectories.begin(), PreIncludeDirectories.end());
+    if (inherited)
+        d.insert(inherited->PreIncludeDirectories.begin(), inherited->PreIncludeDirectories.end());
     d.insert(IncludeDirectories.begin(), IncludeDirectories.end());
+    if (inherited)
+        d.insert(inherited->IncludeDirectories.begin(), inherited->IncludeDirectories.end());
     d.insert(PostIncludeDirectories.begin(), PostIncludeDirectories.end());
+    if (inherited)
+        d.insert(inherited->PostIncludeDirectories.begin(), inherited->PostIncludeDirectories.end());
     return d;
 }
 
@@ -228,6 +353,13 @@ bool NativeCompilerOptionsData::IsIncludeDirectoriesEmpty() const
         PostIncludeDirectories.empty();
 }
 
+bool NativeCompilerOptionsData::IsEmpty() const
+{
+    return Definitions.empty() &&
+        CompileOptions.empty() &&
+        IsIncludeDirectoriesEmpty();
+}
+
 void NativeCompilerOptionsData::merge(const NativeCompilerOptionsData &o, const GroupSettings &s, bool merge_to_system)
 {
     // report conflicts?
@@ -261,11 +393,11 @@ void NativeCompilerOptions::merge(const NativeCompilerOptions &o, const GroupSet
     }*/
 }
 
-void NativeCompilerOptions::addDefinitionsAndIncludeDirectories(builder::Command &c) const
+void NativeCompilerOptions::addDefinitionsAndIncludeDirectories(builder::Command &c, const NativeCompilerOptions *inherited) const
 {
-    auto print_def = [&c](auto &a)
+    auto print_def = [&c](auto &a, const DefinitionsType *b)
     {
-        for (auto &d : a)
+        auto print = [&c](auto &d)
         {
             using namespace sw;
 
@@ -273,11 +405,34 @@ void NativeCompilerOptions::addDefinitionsAndIncludeDirectories(builder::Command
                 c.args.push_back("-D" + d.first);
             else
                 c.args.push_back("-D" + d.first + "=" + d.second);
+        };
+
+        if (!b)
+        {
+            for (auto &d : a)
+                print(d);
+            return;
+        }
+
+        // walk both sorted maps, our values win
+        auto less = a.key_comp();
+        auto i = a.begin();
+        auto j = b->begin();
+        while (i != a.end() || j != b->end())
+        {
+            if (j == b->end() || (i != a.end() && !less(j->first, i->first)))
+            {
+                if (j != b->end() && !less(i->first, j->first))
+                    ++j;
+                print(*i++);
+            }
+            else
+                print(*j++);
         }
     };
 
-    print_def(System.Definitions);
-    print_def(Definitions);
+    print_def(System.Definitions, inherited ? &inherited->System.Definitions : nullptr);
+    print_def(Definitions, inherited ? &inherited->Definitions : nullptr);
 
     auto print_idir = [&c](const auto &a, auto &flag)
     {
@@ -285,13 +440,57 @@ void NativeCompilerOptions::addDefinitionsAndIncludeDirectories(builder::Command
             c.args.push_back(flag + normalize_path(d));
     };
 
-    print_idir(gatherIncludeDirectories(), "-I");
-    print_idir(System.gatherIncludeDirectories(), "-I");
+    print_idir(gatherIncludeDirectories(inherited), "-I");
+    print_idir(System.gatherIncludeDirectories(inherited ? &inherited->System : nullptr), "-I");
 }
 
-void NativeCompilerOptions::addEverything(builder::Command &c) const
+void NativeCompilerOptions::addEverything(builder::Command &c, const NativeCompilerOptions *inherited) const
 {
-    addDefinitionsAndIncludeDirectories(c);
+    addDefinitionsAndIncludeDirectories(c, inherited);
+
+    auto print_idir = [&c](const auto &a, auto &flag)
+    {
+        for (auto &d : a)
+            c.args.push_back(flag + normalize_path(d));
+    };
+
+    print_idir(System.CompileOptions, "");
+    if (inherited)
+        print_idir(inherited->System.CompileOptions, "");
+    print_idir(CompileOptions, "");
+    if (inherited)
+        print_idir(inherited->CompileOptions, "");
+}
+
+bool NativeCompilerOptions::addEverything(builder::Command &c, const NativeCompilerOptions &inherited,
+    const std::shared_ptr<const Strings> &inherited_args) const
+{
+    auto has_same_keys = [](const DefinitionsType &a, const DefinitionsType &b)
+    {
+        for (auto &d : a)
+        {
+            if (b.find(d.first) != b.end())
+                return true;
+        }
+        return false;
+    };
+
+    // these must be merged with inherited options
+    if (has_same_keys(Definitions, inherited.Definitions) ||
+        has_same_keys(System.Definitions, inherited.System.Definitions) ||
+        !PreIncludeDirectories.empty() || !PostIncludeDirectories.empty())
+        return false;
+
+    auto print_def = [&c](auto &a)
+    {
+        for (auto &d : a)
+        {
+            if (d.second.empty())
+                c.args.push_back("-D" + d.first);
+            else
+                c.args.push_back("-D" + d.first + "=" + d.second);
+        }
+    };
 
     auto print_idir = [&c](const auto &a, auto &flag)
     {
@@ -299,8 +498,15 @@ void NativeCompilerOptions::addEverything(builder::Command &c) const
             c.args.push_back(flag + normalize_path(d));
     };
 
+    print_def(System.Definitions);
+    print_def(Definitions);
+    print_idir(IncludeDirectories, "-I");
     print_idir(System.CompileOptions, "");
     print_idir(CompileOptions, "");
+    c.addSharedArgs(inherited_args);
+    // system (toolchain) include dirs are searched last
+    print_idir(System.gatherIncludeDirectories(), "-I");
+    return true;
 }
 
 void NativeLinkerOptionsData::add(const LinkLibrary &l)
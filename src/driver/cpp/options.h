@@ -145,6 +145,22 @@ struct SW_DRIVER_CPP_API FileRegex
     FileRegex(const String &fn, bool recursive = false);
     FileRegex(const std::regex &r, bool recursive = false);
     FileRegex(const path &dir, const std::regex &r, bool recursive = false);
+
+    /// s is a path relative to dir with normalized separators
+    bool match(const String &s) const;
+
+private:
+    enum
+    {
+        Regex,
+        Literal,            // prefix only
+        PrefixAnySuffix,    // prefix.*suffix
+    } kind = Regex;
+    // literal parts of the pattern, used to reject files without running regex
+    String prefix;
+    String suffix;
+
+    void compile(const String &pattern);
 };
 
 struct SW_DRIVER_CPP_API Dependency
@@ -198,8 +214,10 @@ struct SW_DRIVER_CPP_API NativeCompilerOptionsData
     PathOptionsType IncludeDirectories;
     PathOptionsType PostIncludeDirectories;
 
-    PathOptionsType gatherIncludeDirectories() const;
+    /// inherited dirs go after ours in each group
+    PathOptionsType gatherIncludeDirectories(const NativeCompilerOptionsData *inherited = nullptr) const;
     bool IsIncludeDirectoriesEmpty() const;
+    bool IsEmpty() const;
     void merge(const NativeCompilerOptionsData &o, const GroupSettings &s = GroupSettings(), bool merge_to_system = false);
 
     void add(const Definition &d);
@@ -241,8 +259,13 @@ struct SW_DRIVER_CPP_API NativeCompilerOptions : IterableOptions<NativeCompilerO
     void merge(const NativeCompilerOptions &o, const GroupSettings &s = GroupSettings());
     //void unique();
 
-    void addDefinitionsAndIncludeDirectories(builder::Command &c) const;
-    void addEverything(builder::Command &c) const;
+    /// inherited options are added as if they were merged into ours
+    void addDefinitionsAndIncludeDirectories(builder::Command &c, const NativeCompilerOptions *inherited = nullptr) const;
+    void addEverything(builder::Command &c, const NativeCompilerOptions *inherited = nullptr) const;
+    /// renders own options around already rendered inherited ones
+    /// returns false and adds nothing when options must be merged (same definitions)
+    bool addEverything(builder::Command &c, const NativeCompilerOptions &inherited,
+        const std::shared_ptr<const Strings> &inherited_args) const;
 };
 
 struct SW_DRIVER_CPP_API NativeLinkerOptions : IterableOptions<NativeLinkerOptions>,
@@ -71,4 +71,12 @@ Strings getCommandLineImplCPPLanguageStandardGNU(const CommandLineOption<CPPLang
     return { s };
 }
 
+Strings getCommandLineImplPrecompiledHeaderGNU(const CommandLineOption<path> &co, builder::Command *c)
+{
+    // gcc and clang look for it next to the forced include on their own,
+    // so it is only an input that makes users wait for it
+    c->addInput(co.value());
+    return {};
+}
+
 }
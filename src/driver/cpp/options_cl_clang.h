@@ -18,6 +18,7 @@ namespace clang
 
 Strings getCommandLineImplCPPLanguageStandardClang(const CommandLineOption<CPPLanguageStandard> &co, builder::Command *c);
 Strings getCommandLineImplCPPLanguageStandardGNU(const CommandLineOption<CPPLanguageStandard> &co, builder::Command *c);
+Strings getCommandLineImplPrecompiledHeaderGNU(const CommandLineOption<path> &co, builder::Command *c);
 
 struct SW_DRIVER_CPP_API ClangCommonOptions
 {
@@ -78,6 +79,17 @@ struct SW_DRIVER_CPP_API ClangOptions : ClangCommonOptions
         cl::CommandFlag{ "MF" }
     };
 
+    /// precompiled forced include, the compiler takes it instead of the header
+    COMMAND_LINE_OPTION(PrecompiledHeader, path)
+    {
+        cl::CommandLineFunction<path>(&getCommandLineImplPrecompiledHeaderGNU),
+    };
+
+    COMMAND_LINE_OPTION(Language, String)
+    {
+        cl::CommandFlag{ "x" },
+    };
+
     COMMAND_LINE_OPTION(InputFile, path);
 
     COMMAND_LINE_OPTION(OutputFile, path)
@@ -140,15 +152,21 @@ struct SW_DRIVER_CPP_API GNUOptions
             //cl::PlaceAtTheEnd{},
     };
 
-    COMMAND_LINE_OPTION(InputFile, path)
+    /// precompiled forced include, the compiler takes it instead of the header
+    COMMAND_LINE_OPTION(PrecompiledHeader, path)
     {
-        cl::InputDependency{},
+        cl::CommandLineFunction<path>{&getCommandLineImplPrecompiledHeaderGNU},
     };
 
-    /*COMMAND_LINE_OPTION(Language, bool)
+    COMMAND_LINE_OPTION(Language, String)
     {
         cl::CommandFlag{ "x" },
-    };*/
+    };
+
+    COMMAND_LINE_OPTION(InputFile, path)
+    {
+        cl::InputDependency{},
+    };
 
     COMMAND_LINE_OPTION(OutputFile, path)
     {
@@ -24,6 +24,7 @@
 #include <primitives/context.h>
 #include <primitives/date_time.h>
 #include <primitives/executor.h>
+#include <primitives/lock.h>
 #include <primitives/pack.h>
 #include <primitives/symbol.h>
 #include <primitives/templates.h>
@@ -44,6 +45,9 @@ static cl::opt<String> generator("G", cl::desc("Generator"));
 static cl::opt<bool> do_not_rebuild_config("do-not-rebuild-config", cl::Hidden);
 static cl::opt<bool> dry_run("n", cl::desc("Dry run"));
 static cl::opt<bool> debug_configs("debug-configs", cl::desc("Build configs in debug mode"));
+static cl::opt<bool> do_not_use_config_cache("do-not-use-config-cache", cl::desc("Do not load unchanged configs without build"));
+static cl::opt<bool> do_not_use_build_snapshot("do-not-use-build-snapshot", cl::desc("Always run config module and prepare targets"));
+static cl::opt<bool> lazy_prepare("lazy-prepare", cl::desc("Prepare only targets required to build requested ones"));
 
 static cl::opt<String> target_os("target-os");
 static cl::opt<String> compiler("compiler", cl::desc("Set compiler")/*, cl::sub(subcommand_ide)*/);
@@ -66,9 +70,10 @@ path getImportDefinitionsFile()
     return getImportFilePrefix() += ".def";
 }
 
-path getImportPchFile()
+/// precompiled driver header is kept in storage and shared by all configs with the same settings
+path getImportPchFile(const TargetBase &t)
 {
-    return getImportFilePrefix() += ".cpp";
+    return getImportFilePrefix() += "." + t.getConfig(true) + ".cpp";
 }
 
 path getPackageHeader(const ExtendedPackageData &p)
@@ -167,6 +172,210 @@ std::tuple<FilesOrdered, UnresolvedPackages> getFileDependencies(const path &p)
     return { headers, udeps };
 }
 
+#define CONFIG_CACHE_FORMAT_VERSION 2
+
+/// sw.cpp with its local includes and required local files
+/// quoted includes are looked up near the including file first, then in include dirs
+/// missing files are kept with empty hash, so their appearance is noticed
+static void gatherConfigFiles(const path &p, std::map<String, String> &files, const Files &idirs)
+{
+    auto k = normalize_path(p);
+    if (files.find(k) != files.end())
+        return;
+    if (!fs::exists(p))
+    {
+        files[k];
+        return;
+    }
+    auto f = read_file(p);
+    files[k] = sha256(f);
+
+    static const std::regex r_include("#\\s*include\\s*\"([^\"]+)\"");
+    static const std::regex r_local("#pragma +sw +require +local +(\\S+)");
+    std::smatch m;
+    for (auto i = f.cbegin(); std::regex_search(i, f.cend(), m, r_include); i = m.suffix().first)
+    {
+        auto h = p.parent_path() / m[1].str();
+        if (!fs::exists(h))
+        {
+            for (auto &d : idirs)
+            {
+                if (!fs::exists(d / m[1].str()))
+                    continue;
+                // file near the includer would take precedence
+                files[normalize_path(h)];
+                h = d / m[1].str();
+                break;
+            }
+        }
+        gatherConfigFiles(h, files, idirs);
+    }
+    for (auto i = f.cbegin(); std::regex_search(i, f.cend(), m, r_local); i = m.suffix().first)
+        gatherConfigFiles(m[1].str(), files, idirs);
+}
+
+static String getConfigDriverKey()
+{
+    std::error_code ec;
+    auto t = fs::last_write_time(getCurrentModuleName(), ec);
+    return getCurrentModuleNameHash() + ":" + std::to_string(t.time_since_epoch().count()) + (debug_configs ? ":d" : ":r");
+}
+
+/// settings and compiler that config modules are built with
+static String getConfigToolchainKey(const Solution &s)
+{
+    auto k = s.getConfig();
+    if (auto p = s.findProgramByExtension(".cpp"))
+    {
+        std::error_code ec;
+        auto t = fs::last_write_time(p->file, ec);
+        k += ";" + normalize_path(p->file) + ";" + std::to_string(t.time_since_epoch().count());
+    }
+    return k;
+}
+
+/// built config modules keyed by contents of their sources and by the driver,
+/// unchanged configs are loaded without adding targets and running execution plans
+struct ConfigModulesCache
+{
+    struct Entry
+    {
+        String driver;
+        String toolchain;
+        std::map<String, String> files;
+        String dll;
+        fs::file_time_type::rep dll_mtime = 0;
+    };
+
+    std::map<String, Entry> entries;
+
+    ConfigModulesCache()
+    {
+        fn = getUserDirectories().storage_dir_tmp / "db";
+        fn += "." + std::to_string(CONFIG_CACHE_FORMAT_VERSION) + ".configs";
+    }
+
+    void load()
+    {
+        ScopedShareableFileLock lk(fn);
+
+        primitives::BinaryContext b;
+        try
+        {
+            b.load(fn);
+        }
+        catch (std::exception &)
+        {
+            if (fs::exists(fn))
+                LOG_WARN(logger, "Cannot load config cache: " << fn.u8string());
+            return;
+        }
+        while (!b.eof())
+        {
+            String k;
+            Entry e;
+            b.read(k);
+            b.read(e.driver);
+            b.read(e.toolchain);
+            size_t n;
+            b.read(n);
+            while (n--)
+            {
+                String f, h;
+                b.read(f);
+                b.read(h);
+                e.files[f] = h;
+            }
+            b.read(e.dll);
+            b.read(e.dll_mtime);
+            entries[k] = e;
+        }
+    }
+
+    void save() const
+    {
+        primitives::BinaryContext b(entries.size() * 1024);
+        for (auto &[k, e] : entries)
+        {
+            b.write(k);
+            b.write(e.driver);
+            b.write(e.toolchain);
+            b.write(e.files.size());
+            for (auto &[f, h] : e.files)
+            {
+                b.write(f);
+                b.write(h);
+            }
+            b.write(e.dll);
+            b.write(e.dll_mtime);
+        }
+
+        ScopedFileLock lk(fn);
+        b.save(fn);
+    }
+
+private:
+    path fn;
+};
+
+static std::optional<path> findCachedConfig(const path &fn, const String &toolchain)
+{
+    if (do_not_use_config_cache)
+        return {};
+
+    ConfigModulesCache c;
+    c.load();
+    auto i = c.entries.find(normalize_path(fn));
+    if (i == c.entries.end())
+        return {};
+    auto &e = i->second;
+    if (e.driver != getConfigDriverKey() || e.toolchain != toolchain)
+        return {};
+
+    auto dll = fs::u8path(e.dll);
+    std::error_code ec;
+    auto t = fs::last_write_time(dll, ec);
+    if (ec || t.time_since_epoch().count() != e.dll_mtime)
+        return {};
+
+    for (auto &[f, h] : e.files)
+    {
+        auto p = fs::u8path(f);
+        if (h.empty())
+        {
+            if (fs::exists(p))
+                return {};
+            continue;
+        }
+        if (!fs::exists(p) || sha256(read_file(p)) != h)
+            return {};
+    }
+    return dll;
+}
+
+static void addCachedConfig(const path &fn, const path &dll, const FilesOrdered &headers, const String &toolchain, const Files &idirs)
+{
+    if (do_not_use_config_cache)
+        return;
+
+    ConfigModulesCache::Entry e;
+    e.driver = getConfigDriverKey();
+    e.toolchain = toolchain;
+    gatherConfigFiles(fn, e.files, idirs);
+    for (auto &h : headers)
+        gatherConfigFiles(h, e.files, idirs);
+    e.dll = dll.u8string();
+    std::error_code ec;
+    e.dll_mtime = fs::last_write_time(dll, ec).time_since_epoch().count();
+    if (ec)
+        return;
+
+    ConfigModulesCache c;
+    c.load();
+    c.entries[normalize_path(fn)] = e;
+    c.save();
+}
+
 ModuleStorage &getModuleStorage()
 {
     static ModuleStorage modules;
@@ -349,6 +558,7 @@ void Solution::performChecks()
     }
     if (checks.empty())
         return;
+    Checks.createBatches(checks);
     auto ep = ExecutionPlan<Check>::createExecutionPlan(checks);
     if (checks.empty())
     {
@@ -417,7 +627,7 @@ Commands Solution::getCommands() const
     //checkPrepared();
 
     // calling this in any case to set proper command dependencies
-    for (auto &p : children)
+    for (auto &p : getPreparedChildren())
     {
         for (auto &c : p.second->getCommands())
             c->maybe_unused = builder::Command::MU_TRUE;
@@ -436,10 +646,17 @@ Commands Solution::getCommands() const
     return cmds;
 }
 
+const Solution::TargetMap &Solution::getPreparedChildren() const
+{
+    if (lazy_prepare && !TargetsToBuild.empty())
+        return prepared_children;
+    return children;
+}
+
 Files Solution::getGeneratedDirs() const
 {
     Files f;
-    for (auto &p : getChildren())
+    for (auto &p : getPreparedChildren())
     {
         auto c = p.second->getGeneratedDirs();
         f.insert(c.begin(), c.end());
@@ -565,7 +782,7 @@ void Solution::execute(ExecutionPlan<builder::Command> &p) const
             if (!c->needsResponseFile())
             {
                 s += "%" + program_name(programs[c->getProgram()]) + "% ";
-                for (auto &a : c->args)
+                for (auto &a : c->getArguments())
                 {
                     if (should_print(a))
                         s += "\"" + a + "\" ";
@@ -575,7 +792,7 @@ void Solution::execute(ExecutionPlan<builder::Command> &p) const
             else
             {
                 s += "@echo. 2> response.rsp\n";
-                for (auto &a : c->args)
+                for (auto &a : c->getArguments())
                 {
                     if (should_print(a))
                         s += "@echo \"" + a + "\" >> response.rsp\n";
@@ -596,7 +813,7 @@ void Solution::execute(ExecutionPlan<builder::Command> &p) const
         for (auto &c : ep.commands)
         {
             s += c->program.u8string() + " ";
-            for (auto &a : c->args)
+            for (auto &a : c->getArguments())
                 s += a + " ";
             s.resize(s.size() - 1);
             s += "\n\n";
@@ -624,7 +841,7 @@ void Solution::execute(ExecutionPlan<builder::Command> &p) const
         {
             print_string(c->program.u8string());
             print_string(c->working_directory.u8string());
-            for (auto &a : c->args)
+            for (auto &a : c->getArguments())
                 print_string(a);
             s.resize(s.size() - 1);
             s += "\n";
@@ -680,6 +897,9 @@ void Solution::execute(ExecutionPlan<builder::Command> &p) const
         p.execute(e);
         if (!silent)
             LOG_INFO(logger, "Build time: " << t.getTimeFloat() << " s.");
+
+        auto ls = getDependencyLockStats();
+        LOG_DEBUG(logger, "Dependency locks: " << ls.contentions << " contended of " << ls.acquisitions << " acquisitions");
     }
 }
 
@@ -778,6 +998,263 @@ void Solution::build_and_resolve()
     build_and_resolve();
 }
 
+namespace
+{
+
+/// Runs prepare passes of solution targets without global barriers.
+/// Target runs its next pass as soon as all its dependencies have passed it.
+/// When roots are given, only they and targets reachable from them are prepared.
+struct PrepareScheduler
+{
+    struct Node
+    {
+        Target *t;
+        // next pass to run
+        int pass;
+        bool running = false;
+        bool done = false;
+        // nodes blocked on this one
+        std::vector<Node *> waiters;
+    };
+
+    PrepareScheduler(TargetBase::TargetMap &children, Executor &e, const TargetBase::TargetMap *roots = nullptr)
+        : children(children), e(e), roots(roots)
+    {
+    }
+
+    void run()
+    {
+        {
+            std::unique_lock lk(m);
+            if (roots)
+            {
+                for (auto &[p, t] : *roots)
+                {
+                    if (!getNode(t.get()))
+                        throw std::runtime_error("Target to build is not in solution: " + p.toString());
+                }
+            }
+            else
+                addChildren();
+        }
+
+        while (1)
+        {
+            Future<void> *f = nullptr;
+            {
+                std::unique_lock lk(m);
+                if (waited < fs.size())
+                    f = &fs[waited++];
+                else if (running)
+                    throw std::logic_error("prepare: running target without a future");
+                else if (eptr || !resume())
+                    break;
+                else
+                    continue;
+            }
+            // exceptions are caught inside tasks
+            f->get();
+        }
+
+        if (eptr)
+            std::rethrow_exception(eptr);
+    }
+
+    std::vector<Target *> getTargets() const
+    {
+        std::vector<Target *> targets;
+        for (auto &[t, n] : nodes)
+            targets.push_back(t);
+        return targets;
+    }
+
+private:
+    TargetBase::TargetMap &children;
+    Executor &e;
+    const TargetBase::TargetMap *roots;
+    std::mutex m;
+    std::unordered_map<Target *, std::unique_ptr<Node>> nodes;
+    // deque keeps references stable on push_back
+    std::deque<Future<void>> fs;
+    size_t waited = 0;
+    size_t running = 0;
+    size_t running_pass2 = 0;
+    // targets finished pass 3, waiting for their dummy deps to be added to children
+    std::vector<Node *> promotions;
+    size_t known_children = 0;
+    std::exception_ptr eptr;
+
+    // all functions below are called under the lock
+
+    Node *addNode(Target *t)
+    {
+        auto &n = nodes[t];
+        if (!n)
+        {
+            n = std::make_unique<Node>();
+            n->t = t;
+            n->pass = t->getPreparePass();
+        }
+        return n.get();
+    }
+
+    Node *getNode(Target *t)
+    {
+        auto i = nodes.find(t);
+        if (i != nodes.end())
+            return i->second.get();
+
+        // new children (e.g. from dummy children) appear on pass 3,
+        // targets from other solutions are not our business
+        auto c = children.find(t->pkg);
+        if (c == children.end() || c->second.get() != t)
+            return nullptr;
+        auto n = addNode(t);
+        schedule(n);
+        return n;
+    }
+
+    void addChildren()
+    {
+        if (roots || known_children == children.size())
+            return;
+        known_children = children.size();
+        for (auto &[p, t] : children)
+        {
+            if (nodes.find(t.get()) == nodes.end())
+                schedule(addNode(t.get()));
+        }
+    }
+
+    void schedule(Node *n)
+    {
+        if (n->running || n->done || eptr)
+            return;
+        for (auto d : n->t->getPrepareDependencies())
+        {
+            auto dn = getNode(d);
+            if (!dn || dn == n || dn->done || dn->pass > n->pass)
+                continue;
+            dn->waiters.push_back(n);
+            return;
+        }
+        start(n);
+    }
+
+    void start(Node *n)
+    {
+        n->running = true;
+        running++;
+        if (n->pass == 2)
+            running_pass2++;
+        fs.push_back(e.push([this, n] { execute(n); }));
+    }
+
+    void execute(Node *n)
+    {
+        const auto pass = n->pass;
+        bool next = false;
+        try
+        {
+            next = n->t->prepare();
+        }
+        catch (...)
+        {
+            std::unique_lock lk(m);
+            if (!eptr)
+                eptr = std::current_exception();
+        }
+
+        std::unique_lock lk(m);
+        n->running = false;
+        running--;
+        n->pass = n->t->getPreparePass();
+        n->done = !next;
+        if (pass == 2)
+            running_pass2--;
+        if (pass == 3)
+            promotions.push_back(n);
+        else
+            finish(n);
+        promote();
+    }
+
+    /// pass 2 looks up children without the lock,
+    /// so they are changed only when no pass 2 is running
+    void promote()
+    {
+        if (running_pass2 || promotions.empty())
+            return;
+        auto p = std::move(promotions);
+        promotions.clear();
+        for (auto n : p)
+        {
+            if (eptr)
+                break;
+            try
+            {
+                n->t->promoteDummyDependencies();
+            }
+            catch (...)
+            {
+                eptr = std::current_exception();
+            }
+        }
+        for (auto n : p)
+            finish(n);
+    }
+
+    void finish(Node *n)
+    {
+        addChildren();
+        // deps are known after pass 2, also take tools (dummy deps)
+        if (roots)
+        {
+            for (auto d : n->t->getPrepareDependencies(true))
+                getNode(d);
+        }
+        auto w = std::move(n->waiters);
+        n->waiters.clear();
+        for (auto x : w)
+            schedule(x);
+        schedule(n);
+    }
+
+    /// nothing is running
+    /// returns false when all targets are prepared
+    bool resume()
+    {
+        addChildren();
+        if (running)
+            return true;
+
+        // blocked targets are left only with circular dependencies,
+        // run their lowest pass simultaneously like barrier passes did
+        int min_pass = std::numeric_limits<int>::max();
+        for (auto &[t, n] : nodes)
+        {
+            if (!n->done)
+                min_pass = std::min(min_pass, n->pass);
+        }
+        if (min_pass == std::numeric_limits<int>::max())
+            return false;
+
+        size_t n_started = 0;
+        for (auto &[t, n] : nodes)
+        {
+            if (!n->done && n->pass == min_pass)
+            {
+                start(n.get());
+                n_started++;
+            }
+        }
+        LOG_TRACE(logger, "prepare: circular dependencies, running pass " << min_pass << " for " << n_started << " targets");
+        return true;
+    }
+};
+
+}
+
 void Solution::prepare()
 {
     if (prepared)
@@ -804,22 +1281,17 @@ void Solution::prepare()
     // multipass prepare()
     // if we add targets inside this loop,
     // it will automatically handle this situation
-    auto &e = getExecutor();
-    for (std::atomic_bool next_pass = true; next_pass;)
-    {
-        next_pass = false;
-        std::vector<Future<void>> fs;
-        for (auto &[p, t] : getChildren())
-        {
-            fs.push_back(e.push([t = t, &next_pass]
-            {
-                auto np = t->prepare();
-                if (!next_pass)
-                    next_pass = np;
-            }, getChildren().size()));
-        }
-        waitAndGet(fs);
+    if (lazy_prepare && !TargetsToBuild.empty())
+    {
+        PrepareScheduler ps(children, getExecutor(), &TargetsToBuild);
+        ps.run();
+        prepared_children.clear();
+        for (auto t : ps.getTargets())
+            prepared_children[t->pkg] = children.find(t->pkg)->second;
+        LOG_DEBUG(logger, "Prepared " << prepared_children.size() << " of " << children.size() << " targets");
     }
+    else
+        PrepareScheduler(children, getExecutor()).run();
 
     // move to prepare?
     createGeneratedDirs();
@@ -847,14 +1319,10 @@ UnresolvedDependenciesType Solution::gatherUnresolvedDependencies() const
                     continue;
                 }
             }
-            for (const auto &[p,t] : getChildren())
+            if (auto i = getChildren().findSuitable(up); i != getChildren().end())
             {
-                if (up.canBe(p))
-                {
-                    dptr->target = std::static_pointer_cast<NativeTarget>(t);
-                    rm.insert(up);
-                    break;
-                }
+                dptr->target = std::static_pointer_cast<NativeTarget>(i->second);
+                rm.insert(up);
             }
         }
         for (auto &r : rm)
@@ -1108,12 +1576,41 @@ void Build::findCompiler()
 ExecutionPlan<builder::Command> Build::getExecutionPlan() const
 {
     Commands cmds;
-    for (auto &s : solutions)
+    std::unordered_map<builder::Command *, size_t> cfg;
+    for (size_t i = 0; i < solutions.size(); i++)
     {
-        auto c = s.getCommands();
+        auto c = solutions[i].getCommands();
+        for (auto &c2 : c)
+            cfg.emplace(c2.get(), i);
         cmds.insert(c.begin(), c.end());
     }
-    return Solution::getExecutionPlan(cmds);
+    auto ep = Solution::getExecutionPlan(cmds);
+    if (solutions.size() < 2)
+        return ep;
+
+    // interleave starting commands of configurations,
+    // so all of them make progress instead of building one after another
+    auto e = std::find_if(ep.commands.begin(), ep.commands.end(), [](const auto &c)
+    {
+        return !c->dependencies.empty();
+    });
+    // last queue is for commands not coming from solutions (e.g. added on prepare)
+    std::vector<std::vector<std::shared_ptr<builder::Command>>> queues(solutions.size() + 1);
+    for (auto i = ep.commands.begin(); i != e; i++)
+    {
+        auto c = cfg.find(i->get());
+        queues[c == cfg.end() ? solutions.size() : c->second].push_back(*i);
+    }
+    auto o = ep.commands.begin();
+    for (size_t i = 0; o != e; i++)
+    {
+        for (auto &q : queues)
+        {
+            if (i < q.size())
+                *o++ = q[i];
+        }
+    }
+    return ep;
 }
 
 void Build::performChecks()
@@ -1141,6 +1638,9 @@ void Build::prepare()
         fs.push_back(e.push([&s] { s.prepare(); }, solutions.size()));
     waitAndGet(fs);
 
+    // all sources are added at this point
+    saveDirectoryListings();
+
     if (!silent)
         LOG_INFO(logger, "Prepare time: " << t.getTimeFloat() << " s.");
 }
@@ -1228,13 +1728,13 @@ FilesMap Build::build_configs_separate(const Files &files)
         lib.CPPVersion = CPPLanguageStandard::CPP17;
 
         lib += fn;
-        write_file_if_different(getImportPchFile(), cppan_cpp);
-        lib.addPrecompiledHeader("sw/driver/cpp/sw.h", getImportPchFile());
-        if (auto s = lib[getImportPchFile()].template as<NativeSourceFile>())
+        write_file_if_different(getImportPchFile(lib), cppan_cpp);
+        lib.addPrecompiledHeader("sw/driver/cpp/sw.h", getImportPchFile(lib));
+        if (auto s = lib[getImportPchFile(lib)].template as<NativeSourceFile>())
         {
             if (auto C = s->compiler->template as<VisualStudioCompiler>())
             {
-                path of = getImportPchFile();
+                path of = getImportPchFile(lib);
                 of += ".obj";
                 //C->setOutputFile(of);
             }
@@ -1314,6 +1814,9 @@ FilesMap Build::build_configs_separate(const Files &files)
         return lib.getOutputFile();
     };
 
+    // import files and precompiled header in storage are shared by processes
+    ScopedFileLock lk(getImportPchFile(solution));
+
     for (auto &fn : files)
         r[fn] = prepare_config(fn);
 
@@ -1362,6 +1865,10 @@ path Build::build_configs(const std::unordered_set<ExtendedPackageData> &pkgs)
     auto &lib = createTarget(files);
     if (do_not_rebuild_config)
         return lib.getOutputFile();
+
+    // import files and precompiled header in storage are shared by processes
+    ScopedFileLock lk(getImportPchFile(lib));
+
 #if defined(CPPAN_OS_WINDOWS)
     lib += implib;
 #endif
@@ -1426,13 +1933,13 @@ path Build::build_configs(const std::unordered_set<ExtendedPackageData> &pkgs)
     }
 
     // after files
-    write_file_if_different(getImportPchFile(), cppan_cpp);
-    lib.addPrecompiledHeader("sw/driver/cpp/sw.h", getImportPchFile());
-    if (auto s = lib[getImportPchFile()].template as<NativeSourceFile>())
+    write_file_if_different(getImportPchFile(lib), cppan_cpp);
+    lib.addPrecompiledHeader("sw/driver/cpp/sw.h", getImportPchFile(lib));
+    if (auto s = lib[getImportPchFile(lib)].template as<NativeSourceFile>())
     {
         if (auto C = s->compiler->template as<VisualStudioCompiler>())
         {
-            path of = getImportPchFile();
+            path of = getImportPchFile(lib);
             of += ".obj";
             //C->setOutputFile(of);
         }
@@ -1531,6 +2038,14 @@ path Build::build_configs(const std::unordered_set<ExtendedPackageData> &pkgs)
 
 path Build::build(const path &fn)
 {
+    // config build uses the same default settings and compiler
+    auto toolchain = getConfigToolchainKey(*this);
+    if (auto d = findCachedConfig(fn, toolchain))
+    {
+        dll = *d;
+        return dll;
+    }
+
     // separate build
     Build b;
     auto r = b.build_configs_separate({ fn });
@@ -1540,6 +2055,19 @@ path Build::build(const path &fn)
         do_not_rebuild_config = false;
         return build(fn);
     }
+    auto [headers, udeps] = getFileDependencies(fn);
+
+    // include dirs of the config module
+    Files idirs;
+    for (auto &[p, t] : b.solutions[0].children)
+    {
+        auto nt = t->as<NativeExecutedTarget>();
+        if (!nt || !nt->IsConfig)
+            continue;
+        auto d = nt->gatherIncludeDirectories();
+        idirs.insert(d.begin(), d.end());
+    }
+    addCachedConfig(fn, dll, headers, toolchain, idirs);
     return dll;
 }
 
@@ -1716,8 +2244,24 @@ void save(const path &fn, const ExecutionPlan<builder::Command> &p)
         ctx._write(&n, sz);
     };
 
+    // barriers cannot be restored, so edges through them go to their deps directly
+    std::function<void(const builder::Command &, std::unordered_set<builder::Command *> &)> gather_deps;
+    gather_deps = [&gather_deps](const builder::Command &c, std::unordered_set<builder::Command *> &deps)
+    {
+        for (auto &d : c.dependencies)
+        {
+            if (d->as<driver::cpp::BarrierCommand>())
+                gather_deps(*d, deps);
+            else
+                deps.insert(d.get());
+        }
+    };
+
     for (auto &c : p.commands)
     {
+        if (c->as<driver::cpp::BarrierCommand>())
+            continue;
+
         ctx.write(c.get());
 
         uint8_t type = 0;
@@ -1747,24 +2291,28 @@ void save(const path &fn, const ExecutionPlan<builder::Command> &p)
         print_string(c->program.u8string());
         print_string(c->working_directory.u8string());
 
-        ctx.write(c->args.size());
-        for (auto &a : c->args)
+        auto args = c->getArguments();
+        ctx.write(args.size());
+        for (auto &a : args)
             print_string(a);
 
         print_string(c->in.file.u8string());
         print_string(c->out.file.u8string());
         print_string(c->err.file.u8string());
 
-        ctx.write(c->environment.size());
-        for (auto &[k, v] : c->environment)
+        auto env = c->getEnvironment();
+        ctx.write(env.size());
+        for (auto &[k, v] : env)
         {
             print_string(k);
             print_string(v);
         }
 
-        ctx.write(c->dependencies.size());
-        for (auto &d : c->dependencies)
-            ctx.write(d.get());
+        std::unordered_set<builder::Command *> deps;
+        gather_deps(*c, deps);
+        ctx.write(deps.size());
+        for (auto &d : deps)
+            ctx.write(d);
 
         ctx.write(c->inputs.size());
         for (auto &f : c->inputs)
@@ -1783,10 +2331,149 @@ void save(const path &fn, const ExecutionPlan<builder::Command> &p)
     ctx.save(fn);
 }
 
+path Build::getSnapshotFilename() const
+{
+    return getExecutionPlansDir() / "build.snapshot";
+}
+
+String Build::getSnapshotKey() const
+{
+    std::error_code ec;
+    auto t = fs::last_write_time(dll, ec);
+    String k;
+    k += normalize_path(dll) + "\n";
+    k += std::to_string(t.time_since_epoch().count()) + "\n";
+    k += getConfigDriverKey() + "\n";
+    for (auto &s : solutions)
+        k += s.getConfig() + "\n";
+    return k;
+}
+
+static fs::file_time_type::rep getWriteTime(const path &d)
+{
+    std::error_code ec;
+    auto t = fs::last_write_time(d, ec);
+    if (ec)
+        return 0;
+    return t.time_since_epoch().count();
+}
+
+bool Build::loadSnapshot()
+{
+    // generators need targets
+    if (do_not_use_build_snapshot || !generator.empty())
+        return false;
+
+    auto fn = getSnapshotFilename();
+    auto kfn = path(fn) += ".key";
+    if (!fs::exists(kfn))
+        return false;
+
+    try
+    {
+        primitives::BinaryContext b;
+        b.load(kfn);
+
+        String k;
+        b.read(k);
+        if (k != getSnapshotKey())
+            return false;
+
+        // globs may find new files, so directories of sources must be the same
+        // files read on prepare too
+        size_t n;
+        b.read(n);
+        while (n--)
+        {
+            String d;
+            fs::file_time_type::rep t;
+            b.read(d);
+            b.read(t);
+            if (getWriteTime(fs::u8path(d)) != t)
+                return false;
+        }
+
+        snapshot = std::make_unique<ExecutionPlan<builder::Command>>(::sw::load(fn, *this));
+    }
+    catch (std::exception &e)
+    {
+        LOG_DEBUG(logger, "Cannot load build snapshot: " << e.what());
+        return false;
+    }
+
+    for (auto &c : snapshot->commands)
+    {
+        for (auto &o : c->outputs)
+            fs::create_directories(o.parent_path());
+    }
+    return true;
+}
+
+void Build::saveSnapshot(const ExecutionPlan<builder::Command> &p) const
+{
+    if (do_not_use_build_snapshot)
+        return;
+
+    Files dirs;
+    for (auto &s : solutions)
+    {
+        for (auto &[pkg, t] : s.children)
+        {
+            auto nt = t->as<NativeExecutedTarget>();
+            if (!nt)
+                continue;
+            dirs.insert(nt->SourceDir);
+            for (auto &[f, _] : *nt)
+                dirs.insert(f.parent_path());
+            auto &inputs = nt->getPrepareInputs();
+            dirs.insert(inputs.begin(), inputs.end());
+        }
+    }
+
+    auto fn = getSnapshotFilename();
+    auto kfn = path(fn) += ".key";
+    fs::remove(kfn);
+
+    // functions of executed commands cannot be saved
+    for (auto &c : p.commands)
+    {
+        if (c->as<_ExecuteCommand>() && !c->as<driver::cpp::BarrierCommand>())
+        {
+            LOG_DEBUG(logger, "Build snapshot is not saved, plan has command without program: " << c->getName());
+            return;
+        }
+    }
+
+    save(fn, p);
+
+    // key is written last, so partially written snapshot is never used
+    primitives::BinaryContext b;
+    b.write(getSnapshotKey());
+    b.write(dirs.size());
+    for (auto &d : dirs)
+    {
+        b.write(d.u8string());
+        b.write(getWriteTime(d));
+    }
+    b.save(kfn);
+}
+
 bool Build::execute()
 {
     dry_run = ::dry_run;
 
+    if (snapshot && generator.empty())
+    {
+        try
+        {
+            Solution::execute(*snapshot);
+            return true;
+        }
+        catch (std::exception &e) { LOG_ERROR(logger, "error during build: " << e.what()); }
+        catch (...) {}
+        return false;
+    }
+
     if (generateBuildSystem())
         return true;
 
@@ -1810,18 +2497,28 @@ bool Build::execute()
 
     try
     {
-        prepare();
-
-        for (auto &[n, _] : TargetsToBuild)
+        auto set_targets_to_build = [this]()
         {
-            for (auto &s : solutions)
+            for (auto &[n, _] : TargetsToBuild)
             {
-                auto &t = s.children[n];
-                if (!t)
-                    throw std::runtime_error("Empty target");
-                s.TargetsToBuild[n] = t;
+                for (auto &s : solutions)
+                {
+                    auto i = s.children.find(n);
+                    if (i == s.children.end() || !i->second)
+                        throw std::runtime_error("Empty target");
+                    s.TargetsToBuild[n] = i->second;
+                }
             }
-        }
+        };
+
+        // lazy prepare starts from targets to build, so set them before it
+        if (lazy_prepare)
+            set_targets_to_build();
+
+        prepare();
+
+        if (!lazy_prepare)
+            set_targets_to_build();
 
         if (ide)
         {
@@ -1835,6 +2532,15 @@ bool Build::execute()
             }
         }
 
+        if (use_snapshot && TargetsToBuild.empty() && !ide)
+        {
+            // the same plan is saved and executed
+            auto p = getExecutionPlan();
+            saveSnapshot(p);
+            Solution::execute(p);
+            return true;
+        }
+
         Solution::execute();
         return true;
     }
@@ -1966,6 +2672,11 @@ void Build::load(const path &dll)
     if (solutions.empty())
         addSolution();
 
+    // module is not executed at all when nothing changed since the last build
+    this->dll = dll;
+    if (use_snapshot && loadSnapshot())
+        return;
+
     // check
     {
         // some packages want checks in their build body
@@ -102,7 +102,11 @@ protected:
 private:
     std::unordered_set<ExtendedPackageData> known_cfgs;
 
+    // targets prepared with --lazy-prepare
+    TargetMap prepared_children;
+
     void checkPrepared() const;
+    const TargetMap &getPreparedChildren() const;
     Files getGeneratedDirs() const;
     void createGeneratedDirs() const;
     UnresolvedDependenciesType gatherUnresolvedDependencies() const;
@@ -123,6 +127,8 @@ struct SW_DRIVER_CPP_API Build : Solution, PackageScript
     bool configure = false;
     bool perform_checks = true;
     bool ide = false;
+    /// restore prepared commands from the snapshot when config and sources did not change
+    bool use_snapshot = false;
 
     Build();
     ~Build();
@@ -154,11 +160,17 @@ protected:
 
 private:
     path dll;
+    std::unique_ptr<ExecutionPlan<builder::Command>> snapshot;
 
     void setSettings();
     void findCompiler();
     SharedLibraryTarget &createTarget(const Files &files);
 
+    path getSnapshotFilename() const;
+    String getSnapshotKey() const;
+    bool loadSnapshot();
+    void saveSnapshot(const ExecutionPlan<builder::Command> &p) const;
+
 public:
     static PackagePath getSelfTargetName(const Files &files);
 };
@@ -9,12 +9,64 @@
 #include "command.h"
 #include "solution.h"
 
+#include <directories.h>
 #include <language.h>
 #include <target.h>
 
+#include <primitives/context.h>
+#include <primitives/lock.h>
+
+#include <chrono>
+#include <shared_mutex>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "source_file");
+
 namespace sw
 {
 
+#define DIRECTORY_CACHE_FORMAT_VERSION 2
+
+namespace
+{
+
+/// files of a directory (tree), paths are relative to the directory
+struct DirectoryListing
+{
+    /// native path and normalized string for matching
+    std::vector<std::pair<path, String>> files;
+    /// normalized names for existence checks
+    std::unordered_set<String> names;
+    /// directory itself and all visited subdirectories with their modification times
+    std::vector<std::pair<path, fs::file_time_type::rep>> dirs;
+    /// some directory was modified too close to the read,
+    /// so later changes may keep the same time (racily clean listing)
+    bool racy = false;
+
+    bool isMissing() const
+    {
+        return dirs.empty() || dirs[0].second == 0;
+    }
+
+    void addFile(const path &f)
+    {
+        auto s = normalize_path(f);
+        names.insert(s);
+        files.emplace_back(f, std::move(s));
+    }
+};
+
+fs::file_time_type::rep last_write_time(const path &p)
+{
+    error_code ec;
+    auto t = fs::last_write_time(p, ec);
+    if (ec)
+        return 0;
+    return t.time_since_epoch().count();
+}
+
+}
+
 #ifdef _WIN32
 bool IsWindows7OrLater() {
     OSVERSIONINFOEX version_info =
@@ -26,9 +78,12 @@ bool IsWindows7OrLater() {
         &version_info, VER_MAJORVERSION | VER_MINORVERSION, comparison);
 }
 
-Files enumerate_files1(const path &dir, bool recursive = true)
+static void enumerate_files1(const path &root, const path &rel, bool recursive, DirectoryListing &l)
 {
-    Files files;
+    auto dir = rel.empty() ? root : root / rel;
+    // take time before reading, so concurrent changes are seen on the next run
+    l.dirs.emplace_back(rel, last_write_time(dir));
+
     // FindExInfoBasic is 30% faster than FindExInfoStandard.
     static bool can_use_basic_info = IsWindows7OrLater();
     // This is not in earlier SDKs.
@@ -41,12 +96,7 @@ Files enumerate_files1(const path &dir, bool recursive = true)
         FindExSearchNameMatch, NULL, 0);
 
     if (find_handle == INVALID_HANDLE_VALUE)
-    {
-        DWORD win_err = GetLastError();
-        if (win_err == ERROR_FILE_NOT_FOUND || win_err == ERROR_PATH_NOT_FOUND)
-            return files;
-        return files;
-    }
+        return;
     do
     {
         if (wcscmp(ffd.cFileName, TEXT(".")) == 0 || wcscmp(ffd.cFileName, TEXT("..")) == 0)
@@ -57,27 +107,273 @@ Files enumerate_files1(const path &dir, bool recursive = true)
         if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
         {
             if (recursive)
-            {
-                auto f2 = enumerate_files1(dir / ffd.cFileName, recursive);
-                files.insert(f2.begin(), f2.end());
-            }
+                enumerate_files1(root, rel / ffd.cFileName, recursive, l);
         }
         else
-            files.insert(dir / ffd.cFileName);
+        {
+            l.addFile(rel / ffd.cFileName);
+        }
     } while (FindNextFile(find_handle, &ffd));
     FindClose(find_handle);
-    return files;
+}
+#else
+static void enumerate_files1(const path &root, const path &rel, bool recursive, DirectoryListing &l)
+{
+    auto dir = rel.empty() ? root : root / rel;
+    // take time before reading, so concurrent changes are seen on the next run
+    l.dirs.emplace_back(rel, last_write_time(dir));
+
+    error_code ec;
+    for (auto &e : fs::directory_iterator(dir, ec))
+    {
+        auto st = e.symlink_status(ec);
+        if (ec)
+            continue;
+        // do not follow directory links
+        if (fs::is_directory(st))
+        {
+            if (recursive)
+                enumerate_files1(root, rel / e.path().filename(), recursive, l);
+        }
+        else if (fs::is_regular_file(e.status(ec)))
+        {
+            l.addFile(rel / e.path().filename());
+        }
+    }
 }
 #endif
 
-Files enumerate_files_fast(const path &dir, bool recursive = true)
+/// process wide cache of directory listings
+/// listings are persisted between runs and checked against directory times once per process
+/// or once per prepare pass when revalidate is set
+struct DirectoryEnumerationCache
 {
-    return
-#ifdef _WIN32
-        enumerate_files1(dir, recursive);
-#else
-        enumerate_files(dir, recursive);
-#endif
+    std::shared_ptr<const DirectoryListing> get(const path &dir, bool recursive, bool revalidate = false)
+    {
+        std::call_once(loaded, [this] { load(); });
+
+        auto k = (recursive ? "r:" : "d:") + normalize_path(dir);
+        std::shared_ptr<const DirectoryListing> l;
+        bool checked = false;
+        uint64_t checked_pass = 0;
+        uint64_t current_pass;
+        int64_t last_used = 0;
+        {
+            std::shared_lock lk(m);
+            current_pass = pass;
+            auto i = entries.find(k);
+            if (i != entries.end())
+            {
+                l = i->second.listing;
+                checked = i->second.checked;
+                checked_pass = i->second.pass;
+                last_used = i->second.last_used;
+            }
+        }
+        if (checked && (!revalidate || checked_pass == current_pass))
+            return l;
+
+        bool changed = !l || l->racy || !isValid(dir, *l);
+        if (checked && !changed)
+            return l;
+        if (changed)
+        {
+            auto nl = std::make_shared<DirectoryListing>();
+            auto read_time = fs::file_time_type::clock::now();
+            enumerate_files1(dir, {}, recursive, *nl);
+            nl->racy = isRacy(*nl, read_time);
+            l = nl;
+        }
+
+        auto t = now();
+        std::unique_lock lk(m);
+        // missing directories are kept too, so they are not read again during the pass
+        entries[k] = { l, true, t, pass };
+        // also refresh use time from time to time, so used entries are not pruned
+        modified |= changed || t - last_used > use_time_resolution;
+        return l;
+    }
+
+    /// merges used listings into the file, other processes' entries are kept
+    /// listings are checked again in the next pass
+    void save()
+    {
+        std::unique_lock lk(m);
+        ++pass;
+        if (!modified || fn.empty())
+            return;
+
+        ScopedFileLock flk(fn);
+
+        std::unordered_map<String, Entry> merged;
+        read(fn, merged);
+        for (auto &[k, e] : entries)
+        {
+            if (e.checked)
+                merged[k] = e;
+        }
+
+        auto tnow = now();
+        primitives::BinaryContext b(1'000'000); // reserve amount
+        for (auto &[k, e] : merged)
+        {
+            if (tnow - e.last_used > max_unused_time)
+                continue;
+            // racy listings are read again on the next run, like git and ninja do
+            if (e.listing->racy || e.listing->isMissing())
+                continue;
+            b.write(k);
+            b.write(e.last_used);
+            b.write(e.listing->dirs.size());
+            for (auto &[d, t] : e.listing->dirs)
+            {
+                b.write(d.u8string());
+                b.write(t);
+            }
+            b.write(e.listing->files.size());
+            for (auto &[f, s] : e.listing->files)
+                b.write(f.u8string());
+        }
+        b.save(fn);
+        modified = false;
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const DirectoryListing> listing;
+        bool checked = false;
+        /// seconds since epoch
+        int64_t last_used = 0;
+        /// pass when the listing was checked last time
+        uint64_t pass = 0;
+    };
+
+    // entries not used during this time are dropped on save
+    static constexpr int64_t max_unused_time = 30 * 24 * 60 * 60;
+    static constexpr int64_t use_time_resolution = 24 * 60 * 60;
+    // coarse file system time granularity (fat, some network fs)
+    static constexpr auto racy_time_window = std::chrono::seconds(2);
+
+    std::shared_mutex m;
+    std::unordered_map<String, Entry> entries;
+    std::once_flag loaded;
+    path fn;
+    bool modified = false;
+    uint64_t pass = 1;
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static bool isValid(const path &dir, const DirectoryListing &l)
+    {
+        for (auto &[d, t] : l.dirs)
+        {
+            if (last_write_time(d.empty() ? dir : dir / d) != t)
+                return false;
+        }
+        return true;
+    }
+
+    static bool isRacy(const DirectoryListing &l, fs::file_time_type read_time)
+    {
+        for (auto &[d, t] : l.dirs)
+        {
+            if (fs::file_time_type(fs::file_time_type::duration(t)) + racy_time_window >= read_time)
+                return true;
+        }
+        return false;
+    }
+
+    static bool read(const path &fn, std::unordered_map<String, Entry> &entries)
+    {
+        primitives::BinaryContext b;
+        try
+        {
+            b.load(fn);
+        }
+        catch (std::exception &)
+        {
+            return false;
+        }
+        while (!b.eof())
+        {
+            String k;
+            b.read(k);
+
+            auto l = std::make_shared<DirectoryListing>();
+            int64_t last_used;
+            b.read(last_used);
+            size_t n;
+            b.read(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                String d;
+                b.read(d);
+                fs::file_time_type::rep t;
+                b.read(t);
+                l->dirs.emplace_back(fs::u8path(d), t);
+            }
+            b.read(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                String f;
+                b.read(f);
+                l->addFile(fs::u8path(f));
+            }
+            entries[k] = { l, false, last_used, 0 };
+        }
+        return true;
+    }
+
+    void load()
+    {
+        fn = getUserDirectories().storage_dir_tmp / "db";
+        fn += "." + std::to_string(DIRECTORY_CACHE_FORMAT_VERSION) + ".dirs";
+
+        ScopedShareableFileLock lk(fn);
+        if (!read(fn, entries) && fs::exists(fn))
+            LOG_WARN(logger, "Cannot load directory cache: " << fn.u8string());
+    }
+};
+
+static DirectoryEnumerationCache &getDirectoryEnumerationCache()
+{
+    static DirectoryEnumerationCache cache;
+    return cache;
+}
+
+static std::shared_ptr<const DirectoryListing> enumerate_files_fast(const path &dir, bool recursive = true, bool revalidate = false)
+{
+    return getDirectoryEnumerationCache().get(dir, recursive, revalidate);
+}
+
+void saveDirectoryListings()
+{
+    getDirectoryEnumerationCache().save();
+}
+
+/// looks for the file in the cached listing of its directory first,
+/// so adding many files from the same directory costs a single directory read
+/// and a directory time check per prepare pass
+/// files missing there are looked up in the file storage (generated files)
+/// and then on disk (e.g. created by configure scripts after listing)
+static bool exists_cached(const path &p, FileStorage &storage)
+{
+    auto fn = p.filename();
+    if (!fn.empty() && fn != "." && fn != "..")
+    {
+        // files may be removed between passes
+        auto l = enumerate_files_fast(p.parent_path(), false, true);
+        if (l->names.find(normalize_path(fn)) != l->names.end())
+            return true;
+    }
+    if (File(p, storage).isGeneratedAtAll())
+        return true;
+    return fs::exists(p);
 }
 
 SourceFileStorage::SourceFileStorage()
@@ -332,18 +628,11 @@ void SourceFileStorage::op(const FileRegex &r, Op func)
     auto dir = r.dir;
     if (!dir.is_absolute())
         dir = target->SourceDir / dir;
-    auto root_s = normalize_path(dir);
-    if (root_s.back() == '/')
-        root_s.resize(root_s.size() - 1);
-    auto &files = glob_cache[dir][r.recursive];
-    if (files.empty())
-        files = enumerate_files_fast(dir, r.recursive);
-    for (auto &f : files)
+    auto files = enumerate_files_fast(dir, r.recursive);
+    for (auto &[f, s] : files->files)
     {
-        auto s = normalize_path(f);
-        s = s.substr(root_s.size() + 1); // + 1 to skip first slash
-        if (std::regex_match(s, r.r))
-            (this->*func)(f);
+        if (r.match(s))
+            (this->*func)(dir / f);
     }
 }
 
@@ -417,34 +706,29 @@ void SourceFileStorage::startAssignOperation()
 
 bool SourceFileStorage::check_absolute(path &F, bool ignore_errors) const
 {
+    auto &storage = *target->getSolution()->fs;
     if (!F.is_absolute())
     {
         auto p = target->SourceDir / F;
-        if (!fs::exists(p))
+        if (!exists_cached(p, storage))
         {
             p = target->BinaryDir / F;
-            if (!fs::exists(p))
+            if (!exists_cached(p, storage))
             {
-                if (!File(p, *target->getSolution()->fs).isGeneratedAtAll())
-                {
-                    if (ignore_errors)
-                        return false;
-                    throw std::runtime_error("Cannot find source file: " + (target->SourceDir / F).u8string());
-                }
+                if (ignore_errors)
+                    return false;
+                throw std::runtime_error("Cannot find source file: " + (target->SourceDir / F).u8string());
             }
         }
         F = fs::absolute(p);
     }
     else
     {
-        if (!fs::exists(F))
+        if (!exists_cached(F, storage))
         {
-            if (!File(F, *target->getSolution()->fs).isGeneratedAtAll())
-            {
-                if (ignore_errors)
-                    return false;
-                throw std::runtime_error("Cannot find source file: " + F.u8string());
-            }
+            if (ignore_errors)
+                return false;
+            throw std::runtime_error("Cannot find source file: " + F.u8string());
         }
     }
     return true;
@@ -475,8 +759,10 @@ SourceFileStorage::enumerate_files(const FileRegex &r) const
     for (auto &[p, f] : *this)
     {
         auto s = normalize_path(p);
-        s = s.substr(root_s.size() + 1); // + 1 to skip first slash
-        if (std::regex_match(s, r.r))
+        if (s.size() <= root_s.size() + 1 || s[root_s.size()] != '/' ||
+            s.compare(0, root_s.size(), root_s) != 0)
+            continue;
+        if (r.match(s.substr(root_s.size() + 1))) // + 1 to skip first slash
             files[p] = f;
     }
     return files;
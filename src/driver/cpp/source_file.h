@@ -92,7 +92,6 @@ public:
 protected:
     bool autodetect = false;
 
-    void clearGlobCache() { glob_cache.clear(); }
     void remove_full(const path &file);
 
     optional<PackageId> findPackageIdByExtension(const String &e) const;
@@ -109,7 +108,6 @@ private:
     using Op = void (SourceFileStorage::*)(const path &);
 
     std::vector<FileOperation> file_ops;
-    std::unordered_map<path, std::map<bool /* recursive */, Files>> glob_cache;
 
     void add_unchecked(const path &f, bool skip = false);
     void add1(const FileRegex &r);
@@ -178,4 +176,8 @@ struct PrecompiledHeader
     // path pch; // file itself
 };
 
+/// merges directory listings used by this process into the storage cache
+SW_DRIVER_CPP_API
+void saveDirectoryListings();
+
 }
@@ -23,6 +23,10 @@
 #include <primitives/constants.h>
 #include <primitives/sw/settings.h>
 
+#include <deque>
+#include <set>
+#include <sstream>
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "target");
 
@@ -35,6 +39,7 @@ DECLARE_STATIC_LOGGER(logger, "target");
 
 static cl::opt<bool> do_not_mangle_object_names("do-not-mangle-object-names");
 static cl::opt<bool> bull_build("full", cl::desc("Full build (check all conditions)"));
+static cl::opt<bool> auto_pch("auto-pch", cl::desc("Generate precompiled headers from include statistics of previous builds"));
 
 void createDefFile(const path &def, const Files &obj_files)
 #if defined(CPPAN_OS_WINDOWS)
@@ -799,6 +804,51 @@ NativeExecutedTarget::TargetsSet NativeExecutedTarget::gatherAllRelatedDependenc
     return libs;
 }
 
+std::vector<Target *> NativeExecutedTarget::getPrepareDependencies(bool dummy) const
+{
+    // deps are resolved on pass 2
+    if (prepare_pass < 3)
+        return {};
+
+    std::vector<Target *> deps;
+    ((NativeExecutedTarget*)this)->TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>(
+        [this, &deps, dummy](auto &v, auto &s)
+    {
+        for (auto &d : v.Dependencies)
+        {
+            if (d->Disabled || (d->Dummy && !dummy))
+                continue;
+            auto t = d->target.lock();
+            if (!t || t.get() == this)
+                continue;
+            deps.push_back(t.get());
+        }
+    });
+    return deps;
+}
+
+void NativeExecutedTarget::promoteDummyDependencies()
+{
+    // Here we check if some deps are not included in solution target set (children).
+    // They could be in dummy children, because of different target scope, not listed on software network,
+    // but still in use.
+    // We add them back to children.
+    // Example: helpers, small tools, code generators.
+    auto &c = getSolution()->children;
+    auto &dc = getSolution()->dummy_children;
+    for (auto &d2 : Dependencies)
+    {
+        if (d2->target.lock() && c.find(d2->target.lock()->pkg) == c.end() && dc.find(d2->target.lock()->pkg) != dc.end())
+        {
+            c[d2->target.lock()->pkg] = dc[d2->target.lock()->pkg];
+
+            // such packages are not completely independent
+            // they share same source dir (but not binary?) with parent etc.
+            d2->target.lock()->SourceDir = SourceDir;
+        }
+    }
+}
+
 UnresolvedDependenciesType NativeExecutedTarget::gatherUnresolvedDependencies() const
 {
     UnresolvedDependenciesType deps;
@@ -889,7 +939,13 @@ Files NativeExecutedTarget::gatherObjectFilesWithoutLibraries() const
 {
     Files obj;
     for (auto &f : gatherSourceFiles())
+    {
+        // gcc and clang precompiled headers
+        auto e = f->output.file.extension();
+        if (e == ".gch" || e == ".pch")
+            continue;
         obj.insert(f->output.file);
+    }
     for (auto &[f, sf] : *this)
     {
 #ifdef CPPAN_OS_WINDOWS
@@ -1003,6 +1059,8 @@ void NativeExecutedTarget::addPrecompiledHeader(const path &h, const path &cpp)
 
 void NativeExecutedTarget::addPrecompiledHeader(const PrecompiledHeader &p)
 {
+    has_precompiled_header = true;
+
     auto pch = p.source;
     if (!pch.empty())
     {
@@ -1015,6 +1073,16 @@ void NativeExecutedTarget::addPrecompiledHeader(const PrecompiledHeader &p)
     auto pch_fn = pch.parent_path() / (pch.stem().string() + ".pch");
     auto obj_fn = pch.parent_path() / (pch.stem().string() + ".obj");
     auto pdb_fn = pch.parent_path() / (pch.stem().string() + ".pdb");
+    // gcc and clang use precompiled wrapper found next to it as wrapper.gch (wrapper.pch)
+    // and silently fall back to the text when it is missing or built with other flags
+    auto gnu_h = pch.parent_path() / (pch.stem().string() + ".pch.h");
+    auto gnu_cpp = pch.parent_path() / (pch.stem().string() + ".pch.cpp");
+    auto gnu_pch_fn = [&gnu_h](bool clang)
+    {
+        auto f = gnu_h;
+        return f += clang ? ".pch" : ".gch";
+    };
+    bool gnu = false;
 
     // before added 'create' pch
     for (auto &f : gatherSourceFiles())
@@ -1039,21 +1107,25 @@ void NativeExecutedTarget::addPrecompiledHeader(const PrecompiledHeader &p)
             }
             else if (auto c = sf->compiler->as<ClangCompiler>())
             {
-                c->ForcedIncludeFiles().push_back(p.header);
-                //c->PrecompiledHeaderFilename() = pch_fn;
-                //c->PrecompiledHeaderFilename.input_dependency = true;
-                //c->PrecompiledHeader().use = p.header;
+                c->ForcedIncludeFiles().push_back(gnu_h);
+                c->PrecompiledHeader() = gnu_pch_fn(true);
+                gnu = true;
             }
             else if (auto c = sf->compiler->as<GNUCompiler>())
             {
-                c->ForcedIncludeFiles().push_back(p.header);
-                //c->PrecompiledHeaderFilename() = pch_fn;
-                //c->PrecompiledHeaderFilename.input_dependency = true;
-                //c->PrecompiledHeader().use = p.header;
+                c->ForcedIncludeFiles().push_back(gnu_h);
+                c->PrecompiledHeader() = gnu_pch_fn(false);
+                gnu = true;
             }
         }
     }
 
+    if (gnu)
+    {
+        write_file_if_different(gnu_h, "#pragma once\n\n#include \"" + normalize_path(p.header) + "\"\n");
+        write_file_if_different(gnu_cpp, "#include \"" + normalize_path(gnu_h) + "\"\n");
+    }
+
     *this += pch;
 
     if (auto sf = ((*this)[pch]).as<NativeSourceFile>())
@@ -1078,21 +1150,203 @@ void NativeExecutedTarget::addPrecompiledHeader(const PrecompiledHeader &p)
         }
         else if (auto c = sf->compiler->as<ClangCompiler>())
         {
-            c->ForcedIncludeFiles().push_back(p.header);
-            //c->PrecompiledHeaderFilename() = pch_fn;
-            //c->PrecompiledHeaderFilename.input_dependency = true;
-            //c->PrecompiledHeader().create = p.header;
+            c->ForcedIncludeFiles().push_back(gnu_h);
+            c->PrecompiledHeader() = gnu_pch_fn(true);
         }
         else if (auto c = sf->compiler->as<GNUCompiler>())
         {
-            c->ForcedIncludeFiles().push_back(p.header);
-            //c->PrecompiledHeaderFilename() = pch_fn;
-            //c->PrecompiledHeaderFilename.input_dependency = true;
-            //c->PrecompiledHeader().use = p.header;
+            c->ForcedIncludeFiles().push_back(gnu_h);
+            c->PrecompiledHeader() = gnu_pch_fn(false);
+        }
+    }
+
+    if (!gnu)
+        return;
+
+    // the wrapper is built as header, the result is not linked
+    *this += gnu_cpp;
+    if (auto sf = ((*this)[gnu_cpp]).as<NativeSourceFile>())
+    {
+        if (auto c = sf->compiler->as<ClangCompiler>())
+        {
+            c->Language = "c++-header";
+            sf->setOutputFile(gnu_pch_fn(true));
+        }
+        else if (auto c = sf->compiler->as<GNUCompiler>())
+        {
+            c->Language = "c++-header";
+            sf->setOutputFile(gnu_pch_fn(false));
         }
     }
 }
 
+void NativeExecutedTarget::addAutoPrecompiledHeader()
+{
+    // pch pays off only when many files share headers
+    const size_t min_files = 4;
+    // share of files that must include a header
+    const double min_usage = 0.5;
+
+    static const std::set<String> cpp_exts{ ".cpp", ".cxx", ".c++", ".cc", ".CPP", ".C++", ".CXX", ".C", ".CC" };
+    static const std::set<String> header_exts{ "", ".h", ".hh", ".hpp", ".hxx", ".h++", ".H++", ".HPP", ".H" };
+    // such headers cannot be included on their own
+    static const std::set<String> internal_dirs{ "bits", "detail", "details", "impl", "internal", "private" };
+
+    std::vector<NativeSourceFile *> files;
+    for (auto &f : gatherSourceFiles())
+    {
+        auto c = f->compiler.get();
+        if (!c || (!c->as<VisualStudioCompiler>() && !c->as<ClangClCompiler>() &&
+            !c->as<ClangCompiler>() && !c->as<GNUCompiler>()))
+            continue;
+        // c files cannot use c++ pch
+        if (f->BuildAs == NativeSourceFile::C ||
+            (f->BuildAs == NativeSourceFile::BasedOnExtension && cpp_exts.find(f->file.extension().string()) == cpp_exts.end()))
+        {
+            LOG_DEBUG(logger, getPackage().target_name + ": auto pch is not used, target has c file: " + f->file.u8string());
+            return;
+        }
+        files.push_back(f);
+    }
+    if (files.size() < min_files)
+        return;
+
+    PrecompiledHeader pch;
+    pch.header = BinaryDir.parent_path() / "pch" / "sw.auto.h";
+    pch.source = BinaryDir.parent_path() / "pch" / "sw.auto.cpp";
+
+    const String prefix = "#include <";
+
+    // files built with the pch may not report its headers as their deps,
+    // so previously selected headers are trusted without them
+    std::set<String> previous;
+    if (fs::exists(pch.header))
+    {
+        std::istringstream ss(read_file(pch.header));
+        String line;
+        while (std::getline(ss, line))
+        {
+            if (line.compare(0, prefix.size(), prefix) != 0 || line.size() < prefix.size() + 2)
+                continue;
+            previous.insert(line.substr(prefix.size(), line.size() - prefix.size() - 1));
+        }
+    }
+
+    // only <> includes from the top of the file are taken, in their order,
+    // anything after other directives or code may depend on macros or includes before it
+    // (including internal headers or include_next wrappers directly is not possible this way)
+    auto get_leading_includes = [](const path &fn)
+    {
+        Strings includes;
+        std::istringstream ss(read_file(fn));
+        String line;
+        bool comment = false;
+        while (std::getline(ss, line))
+        {
+            boost::trim(line);
+            if (comment || line.compare(0, 2, "/*") == 0)
+            {
+                auto p = line.find("*/", comment ? 0 : 2);
+                comment = p == line.npos;
+                if (comment)
+                    continue;
+                line = line.substr(p + 2);
+                boost::trim(line);
+            }
+            if (line.empty() || line.compare(0, 2, "//") == 0)
+                continue;
+            if (line[0] != '#')
+                break;
+            line = boost::trim_left_copy(line.substr(1));
+            if (line.compare(0, 7, "include") != 0)
+                break;
+            line = boost::trim_left_copy(line.substr(7));
+            auto e = line.find('>');
+            if (line.empty() || line[0] != '<' || e == line.npos)
+                break;
+            includes.push_back(line.substr(1, e - 1));
+        }
+        return includes;
+    };
+
+    auto resolves_to = [](const String &dep, const String &include)
+    {
+        if (dep.size() <= include.size() || dep[dep.size() - include.size() - 1] != '/')
+            return false;
+#ifdef _WIN32
+        return boost::iends_with(dep, include);
+#else
+        return boost::ends_with(dep, include);
+#endif
+    };
+
+    // only external (system and dependency) headers are stable enough
+    auto is_external = [this](const path &p)
+    {
+        if (is_under_root(p, SourceDir) || is_under_root(p, BinaryDir.parent_path()))
+            return false;
+        return !File(p, *getSolution()->fs).isGeneratedAtAll();
+    };
+
+    // implicit dependencies of object files from the previous build tell where includes resolve to
+    std::unordered_map<String, size_t> usage;
+    std::unordered_map<String, bool> external;
+    Strings order;
+    for (auto f : files)
+    {
+        auto includes = get_leading_includes(f->file);
+        for (auto &i : includes)
+        {
+            if (usage[i]++ == 0)
+                order.push_back(i);
+        }
+        for (auto id : f->output.getFileRecord().implicit_dependencies)
+        {
+            auto &p = getPathTable().get(id);
+            auto d = normalize_path(p);
+            for (auto &i : includes)
+            {
+                if (!resolves_to(d, i))
+                    continue;
+                auto e = external.find(i);
+                if (e == external.end())
+                    external[i] = is_external(p);
+                else
+                    e->second = e->second && is_external(p);
+            }
+        }
+    }
+
+    Strings headers;
+    for (auto &i : order)
+    {
+        if (usage[i] < files.size() * min_usage)
+            continue;
+        auto e = external.find(i);
+        if (e == external.end() ? previous.find(i) == previous.end() : !e->second)
+            continue;
+        auto p = fs::u8path(i);
+        if (header_exts.find(p.extension().string()) == header_exts.end())
+            continue;
+        bool internal = false;
+        for (auto &c : p.parent_path())
+            internal |= internal_dirs.find(c.string()) != internal_dirs.end();
+        if (!internal)
+            headers.push_back(i);
+    }
+    if (headers.empty())
+        return;
+
+    // same order as in sources
+    String s = "#pragma once\n\n";
+    for (auto &h : headers)
+        s += prefix + h + ">\n";
+
+    // do not touch the header when selection is the same
+    write_file_if_different(pch.header, s);
+    addPrecompiledHeader(pch);
+}
+
 NativeExecutedTarget &NativeExecutedTarget::operator=(const PrecompiledHeader &pch)
 {
     addPrecompiledHeader(pch);
@@ -1128,6 +1382,45 @@ Commands NativeExecutedTarget::getGeneratedCommands() const
 }
 
 Commands NativeExecutedTarget::getCommands() const
+{
+    std::unique_lock lk(commands_mutex);
+    if (!cached_commands)
+    {
+        cached_commands = getCommands1();
+        cached_dependencies.clear();
+        for (auto &c : *cached_commands)
+            cached_dependencies[c.get()] = c->dependencies;
+        return *cached_commands;
+    }
+
+    // restore edges removed by previous execution plan
+    for (auto &c : *cached_commands)
+    {
+        auto &d = cached_dependencies[c.get()];
+        c->dependencies.insert(d.begin(), d.end());
+    }
+    return *cached_commands;
+}
+
+void NativeExecutedTarget::invalidateCommands()
+{
+    std::unique_lock lk(commands_mutex);
+    cached_commands.reset();
+    cached_dependencies.clear();
+}
+
+/// makes one command depending on all of deps,
+/// so n commands depend on m deps with n + m edges instead of n * m
+static std::shared_ptr<builder::Command> makeBarrier(const NativeExecutedTarget &t, const Commands &deps)
+{
+    auto b = std::make_shared<driver::cpp::BarrierCommand>(*t.getSolution()->fs, __FILE__, __LINE__);
+    // no inputs and outputs, so it is never outdated and never counted
+    b->dependencies = deps;
+    b->name = "barrier: [" + t.pkg.target_name + "]";
+    return b;
+}
+
+Commands NativeExecutedTarget::getCommands1() const
 {
     Commands cmds;
     if (already_built)
@@ -1212,8 +1505,13 @@ Commands NativeExecutedTarget::getCommands() const
     }
 
     // add generated files
-    for (auto &cmd : cmds)
-        cmd->dependencies.insert(generated.begin(), generated.end());
+    if (!generated.empty())
+    {
+        auto b = makeBarrier(*this, generated);
+        for (auto &cmd : cmds)
+            cmd->dependencies.insert(b);
+        cmds.insert(b);
+    }
     cmds.insert(generated.begin(), generated.end());
 
     //LOG_DEBUG(logger, "Building target: " + pkg.ppath.toString());
@@ -1254,14 +1552,23 @@ Commands NativeExecutedTarget::getCommands() const
         };
 
         // add dependencies on generated commands from dependent targets
+        Commands deps_generated;
         for (auto &l : get_tgts())
         {
             for (auto &c2 : ((NativeExecutedTarget*)l)->getGeneratedCommands())
             {
-                for (auto &c : cmds)
-                    c->dependencies.insert(c2);
+                // do not make our own commands wait for themselves
+                if (cmds.find(c2) == cmds.end())
+                    deps_generated.insert(c2);
             }
         }
+        if (!deps_generated.empty())
+        {
+            auto b = makeBarrier(*this, deps_generated);
+            for (auto &c : cmds)
+                c->dependencies.insert(b);
+            cmds.insert(b);
+        }
 
         // link deps
         if (getSelectedTool() != Librarian.get())
@@ -1412,6 +1719,7 @@ void NativeExecutedTarget::findSources()
         if (bfn.empty())
             throw std::runtime_error("");
 
+        prepare_inputs.insert(bfn);
         auto b = read_file(bfn);
         auto f = bazel::parse(b);
         String project_name;
@@ -1637,10 +1945,209 @@ void NativeExecutedTarget::detectLicenseFile()
     }
 }
 
+std::shared_ptr<const NativeOptions> NativeExecutedTarget::getUsageRequirements() const
+{
+    std::call_once(usage_requirements_once, [this]
+    {
+        // same as merging groups one by one into dependents
+        GroupSettings s;
+        s.merge_to_self = false;
+        auto u = std::make_shared<NativeOptions>();
+        u->merge(Protected, s);
+        u->merge(Public, s);
+        u->merge(Interface, s);
+        UsageRequirements = u;
+    });
+    return UsageRequirements;
+}
+
+const std::vector<DependencyPtr> *NativeExecutedTarget::getExportedDependencies() const
+{
+    if (!exported_dependencies_ready.load(std::memory_order_acquire))
+        return nullptr;
+    return &ExportedDependencies;
+}
+
+void NativeExecutedTarget::inheritDependencies()
+{
+    // Transitive closure over non-private dependencies with include directories only handling.
+    // Targets store their exported closure, so dependents take it as is
+    // instead of walking the whole graph below them again.
+    // Dependency graph may contain cycles or targets that are not ready yet,
+    // then we iterate over their option groups directly.
+    struct Closure
+    {
+        struct L
+        {
+            size_t operator()(const DependencyPtr &p1, const DependencyPtr &p2) const
+            {
+                return (*p1) < (*p2);
+            }
+        };
+
+        NativeExecutedTarget *self;
+        // closure for dependents is independent of them
+        bool exported;
+        // exported closure depends on the dependent (protected inheritance)
+        bool failed = false;
+
+        // why such sorting (L)?
+        std::set<DependencyPtr, L> deps;
+        std::vector<DependencyPtr> deps_ordered;
+        std::deque<DependencyPtr> queue;
+
+        Closure(NativeExecutedTarget *self, bool exported)
+            : self(self), exported(exported)
+        {
+        }
+
+        bool isSelf(const DependencyPtr &d) const
+        {
+            return !exported && d->target.lock().get() == self;
+        }
+
+        void add(const DependencyPtr &d2, bool parent_idir_only, bool copy, bool expand)
+        {
+            auto i = deps.find(d2);
+            if (i == deps.end())
+            {
+                auto di = copy ? std::make_shared<Dependency>(*d2) : d2;
+                // if we inserted 3rd party dep (d2=di) of idir_only dep (d),
+                // we mark it always as idir_only
+                if (parent_idir_only)
+                    di->IncludeDirectoriesOnly = true;
+                deps.insert(di);
+                deps_ordered.push_back(di);
+                if (expand)
+                    queue.push_back(di);
+                return;
+            }
+
+            // we already have this dep
+            // if parent dep is not idir_only, then we choose whether to build dep
+            auto &di = *i;
+            if (!parent_idir_only && !d2->IncludeDirectoriesOnly && di->IncludeDirectoriesOnly)
+            {
+                di->IncludeDirectoriesOnly = false;
+                // also visit it again (!) if processing changed for it
+                if (expand)
+                    queue.push_back(di);
+            }
+        }
+
+        void process(const DependencyPtr &d)
+        {
+            auto t = d->target.lock();
+            if (!t)
+                throw std::logic_error("Unresolved package on stage 2: " + d->package.toString());
+            auto &nt = *(NativeExecutedTarget*)t.get();
+
+            // exported closure of dep already has all of its (idir only or not) deps
+            if (auto e = nt.getExportedDependencies())
+            {
+                for (auto &d2 : *e)
+                {
+                    if (!isSelf(d2))
+                        add(d2, d->IncludeDirectoriesOnly, true, false);
+                }
+                return;
+            }
+
+            // iterate over child deps
+            nt.TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>([this, &d](auto &v, auto &s)
+            {
+                // nothing to do with private inheritance
+                if (s.Inheritance == InheritanceType::Private)
+                    return;
+
+                for (auto &d2 : v.Dependencies)
+                {
+                    if (isSelf(d2))
+                        continue;
+                    if (d2->isDummy())
+                        continue;
+
+                    if (s.Inheritance == InheritanceType::Protected)
+                    {
+                        if (exported)
+                        {
+                            failed = true;
+                            return;
+                        }
+                        if (!self->hasSameParent(d2->target.lock().get()))
+                            continue;
+                    }
+
+                    add(d2, d->IncludeDirectoriesOnly, true, true);
+                }
+            });
+        }
+
+        void run()
+        {
+            while (!queue.empty() && !failed)
+            {
+                auto d = queue.front();
+                queue.pop_front();
+                process(d);
+            }
+        }
+    };
+
+    // set our initial deps
+    Closure c(this, false);
+    TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>([this, &c](auto &v, auto &s)
+    {
+        //DEBUG_BREAK_IF_STRING_HAS(pkg.ppath.toString(), "sw.server.protos");
+
+        for (auto &d : v.Dependencies)
+        {
+            if (d->target.lock().get() == this)
+                continue;
+            if (d->isDummy())
+                continue;
+            if (c.deps.find(d) != c.deps.end())
+                continue;
+
+            c.deps.insert(d);
+            c.deps_ordered.push_back(d);
+            c.queue.push_back(d);
+        }
+    });
+    c.run();
+    for (auto &d : c.deps_ordered)
+        Dependencies.insert(d);
+
+    // now closure for our dependents, it does not include private deps
+    Closure e(this, true);
+    TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>([&e](auto &v, auto &s)
+    {
+        if (s.Inheritance == InheritanceType::Private)
+            return;
+        for (auto &d : v.Dependencies)
+        {
+            if (d->isDummy())
+                continue;
+            if (s.Inheritance == InheritanceType::Protected)
+                e.failed = true;
+            e.add(d, false, true, true);
+        }
+    });
+    e.run();
+    if (!e.failed)
+    {
+        ExportedDependencies = std::move(e.deps_ordered);
+        exported_dependencies_ready.store(true, std::memory_order_release);
+    }
+}
+
 bool NativeExecutedTarget::prepare()
 {
     //DEBUG_BREAK_IF_STRING_HAS(pkg.ppath.toString(), "primitives.settings");
 
+    // every pass changes target state
+    invalidateCommands();
+
     /*{
         auto is_changed = [this](const path &p)
         {
@@ -1753,8 +2260,6 @@ bool NativeExecutedTarget::prepare()
         }
         Definitions["SW_STATIC="];
 
-        clearGlobCache();
-
         //if (HeaderOnly && !HeaderOnly.value())
         //LOG_INFO(logger, "compiling target: " + pkg.ppath.toString());
     }
@@ -1780,14 +2285,9 @@ bool NativeExecutedTarget::prepare()
                 /*if (d->target != nullptr)
                     continue;*/
 
-                for (auto &[pp, t] : solution->getChildren())
-                {
-                    if (d->getPackage().canBe(t->getPackage()))
-                    {
-                        d->setTarget(std::static_pointer_cast<NativeTarget>(t));
-                        break;
-                    }
-                }
+                auto &c = solution->getChildren();
+                if (auto i = c.findSuitable(d->getPackage()); i != c.end())
+                    d->setTarget(std::static_pointer_cast<NativeTarget>(i->second));
                 if (!d->target.lock())
                     throw std::logic_error("Unresolved package on stage 1: " + d->getPackage().toString());
             }
@@ -1797,164 +2297,10 @@ bool NativeExecutedTarget::prepare()
     case 3:
     // inheritance
     {
-        struct H
-        {
-            size_t operator()(const DependencyPtr &p) const
-            {
-                return std::hash<Dependency>()(*p);
-            }
-        };
-        struct L
-        {
-            size_t operator()(const DependencyPtr &p1, const DependencyPtr &p2) const
-            {
-                return (*p1) < (*p2);
-            }
-        };
-
-        //DEBUG_BREAK_IF_STRING_HAS(pkg.toString(), "protoc-");
-
-        // why such sorting (L)?
-        //std::unordered_map<DependencyPtr, InheritanceType, H> deps;
-        std::map<DependencyPtr, InheritanceType, L> deps;
-        //std::map<DependencyPtr, InheritanceType> deps;
-        std::vector<DependencyPtr> deps_ordered;
-
-        // set our initial deps
-        TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>(
-            [this, &deps, &deps_ordered](auto &v, auto &s)
-        {
-            //DEBUG_BREAK_IF_STRING_HAS(pkg.ppath.toString(), "sw.server.protos");
-
-            for (auto &d : v.Dependencies)
-            {
-                if (d->target.lock().get() == this)
-                    continue;
-                if (d->isDummy())
-                    continue;
-
-                deps.emplace(d, s.Inheritance);
-                deps_ordered.push_back(d);
-            }
-        });
-
-        while (1)
-        {
-            bool new_dependency = false;
-            auto deps2 = deps;
-            for (auto &[d, _] : deps2)
-            {
-                if (d->target.lock() == nullptr)
-                {
-                    throw std::logic_error("Unresolved package on stage 2: " + d->package.toString());
-                    /*LOG_ERROR(logger, "Unresolved package on stage 2: " + d->package.toString() + ". Resolving inplace");
-                    auto id = d->package.resolve();
-                    d->target = std::static_pointer_cast<NativeTarget>(getSolution()->getTargetPtr(id));*/
-                }
-
-                // iterate over child deps
-                (*(NativeExecutedTarget*)d->target.lock().get()).TargetOptionsGroup::iterate<WithoutSourceFileStorage, WithNativeOptions>(
-                    [this, &new_dependency, &deps, &d, &deps_ordered](auto &v, auto &s)
-                {
-                    // nothing to do with private inheritance
-                    if (s.Inheritance == InheritanceType::Private)
-                        return;
-
-                    for (auto &d2 : v.Dependencies)
-                    {
-                        if (d2->target.lock().get() == this)
-                            continue;
-                        if (d2->isDummy())
-                            continue;
-
-                        if (s.Inheritance == InheritanceType::Protected && !hasSameParent(d2->target.lock().get()))
-                            continue;
-
-                        auto copy = std::make_shared<Dependency>(*d2);
-                        auto[i, inserted] = deps.emplace(copy,
-                            s.Inheritance == InheritanceType::Interface ?
-                            InheritanceType::Public : s.Inheritance
-                        );
-                        if (inserted)
-                            deps_ordered.push_back(copy);
-
-                        // include directories only handling
-                        auto di = i->first;
-                        if (inserted)
-                        {
-                            // new dep is added
-                            if (d->IncludeDirectoriesOnly)
-                            {
-                                // if we inserted 3rd party dep (d2=di) of idir_only dep (d),
-                                // we mark it always as idir_only
-                                di->IncludeDirectoriesOnly = true;
-                            }
-                            else
-                            {
-                                // otherwise we keep idir_only flag as is
-                            }
-                            new_dependency = true;
-                        }
-                        else
-                        {
-                            // we already have this dep
-                            if (d->IncludeDirectoriesOnly)
-                            {
-                                // left as is if parent (d) idir_only
-                            }
-                            else
-                            {
-                                // if parent dep is not idir_only, then we choose whether to build dep
-                                if (d2->IncludeDirectoriesOnly)
-                                {
-                                    // left as is if d2 idir_only
-                                }
-                                else
-                                {
-                                    if (di->IncludeDirectoriesOnly)
-                                    {
-                                        // also mark as new dependency (!) if processing changed for it
-                                        new_dependency = true;
-                                    }
-                                    // if d2 is not idir_only, we set so for di
-                                    di->IncludeDirectoriesOnly = false;
-                                }
-                            }
-                        }
-                    }
-                });
-            }
-
-            if (!new_dependency)
-            {
-                for (auto &d : deps_ordered)
-                    //add(deps.find(d)->first);
-                    Dependencies.insert(deps.find(d)->first);
-                break;
-            }
-        }
-
-        // Here we check if some deps are not included in solution target set (children).
-        // They could be in dummy children, because of different target scope, not listed on software network,
-        // but still in use.
-        // We add them back to children.
-        // Example: helpers, small tools, code generators.
-        {
-            auto &c = getSolution()->children;
-            auto &dc = getSolution()->dummy_children;
-            for (auto &d2 : Dependencies)
-            {
-                if (d2->target.lock() && c.find(d2->target.lock()->pkg) == c.end() && dc.find(d2->target.lock()->pkg) != dc.end())
-                {
-                    c[d2->target.lock()->pkg] = dc[d2->target.lock()->pkg];
-
-                    // such packages are not completely independent
-                    // they share same source dir (but not binary?) with parent etc.
-                    d2->target.lock()->SourceDir = SourceDir;
-                }
-            }
-        }
+        inheritDependencies();
 
+        // dummy deps are added to children by the prepare scheduler,
+        // see promoteDummyDependencies()
     }
     RETURN_PREPARE_PASS;
     case 4:
@@ -1971,9 +2317,13 @@ bool NativeExecutedTarget::prepare()
             if (d->isDummy())
                 continue;
 
+            auto &dt = *(NativeExecutedTarget*)d->target.lock().get();
             GroupSettings s;
-            //s.merge_to_self = false;
-            merge(*(NativeExecutedTarget*)d->target.lock().get(), s);
+            s.merge_to_self = false;
+            SourceFileStorage::merge(dt.Protected, s);
+            SourceFileStorage::merge(dt.Public, s);
+            SourceFileStorage::merge(dt.Interface, s);
+            TargetOptions::merge(*dt.getUsageRequirements(), s);
         }
     }
     RETURN_PREPARE_PASS;
@@ -1999,6 +2349,9 @@ bool NativeExecutedTarget::prepare()
             f = this->SourceFileMapThis::operator[](p) = L->createSourceFile(p, this);
         }
 
+        if ((AutoPrecompiledHeader || auto_pch) && !has_precompiled_header && !IsConfig)
+            addAutoPrecompiledHeader();
+
         auto files = gatherSourceFiles();
 
         // copy headers to install dir
@@ -2026,10 +2379,16 @@ bool NativeExecutedTarget::prepare()
             *this += "_DEBUG"_d;
 
         // merge file compiler options with target compiler options
+        // target options are shared between files, not copied into each of them
+        auto opts = std::make_shared<NativeCompilerOptions>((const NativeCompilerOptions &)*this);
+        // and rendered only once for all commands
+        builder::Command rc;
+        opts->addEverything(rc);
+        auto args = std::make_shared<const Strings>(std::move(rc.args));
         for (auto &f : files)
         {
             // set everything before merge!
-            f->compiler->merge(*this);
+            f->compiler->merge(opts, args);
 
             if (auto c = f->compiler->as<VisualStudioCompiler>())
             {
@@ -2055,8 +2414,7 @@ bool NativeExecutedTarget::prepare()
                 if (IsConfig && c->PrecompiledHeader && c->PrecompiledHeader().create)
                 {
                     // why?
-                    c->IncludeDirectories.erase(BinaryDir);
-                    c->IncludeDirectories.erase(BinaryPrivateDir);
+                    c->eraseIncludeDirectories({ BinaryDir, BinaryPrivateDir });
                 }
             }
             else if (auto c = f->compiler->as<ClangCompiler>())
@@ -2066,6 +2424,10 @@ bool NativeExecutedTarget::prepare()
 
                 if (ExportAllSymbols)
                     c->VisibilityHidden = false;
+
+                // precompiled wrapper is shared by configs with the same settings
+                if (IsConfig && c->Language && c->Language() == "c++-header")
+                    c->eraseIncludeDirectories({ BinaryDir, BinaryPrivateDir });
             }
             else if (auto c = f->compiler->as<ClangClCompiler>())
             {
@@ -2077,8 +2439,7 @@ bool NativeExecutedTarget::prepare()
                 if (IsConfig && c->PrecompiledHeader && c->PrecompiledHeader().create)
                 {
                     // why?
-                    c->IncludeDirectories.erase(BinaryDir);
-                    c->IncludeDirectories.erase(BinaryPrivateDir);
+                    c->eraseIncludeDirectories({ BinaryDir, BinaryPrivateDir });
                 }
             }
             else if (auto c = f->compiler->as<GNUCompiler>())
@@ -2100,6 +2461,10 @@ bool NativeExecutedTarget::prepare()
 
                 if (ExportAllSymbols)
                     c->VisibilityHidden = false;
+
+                // precompiled wrapper is shared by configs with the same settings
+                if (IsConfig && c->Language && c->Language() == "c++-header")
+                    c->eraseIncludeDirectories({ BinaryDir, BinaryPrivateDir });
             }
         }
 
@@ -2384,6 +2749,7 @@ void NativeExecutedTarget::initLibrary(LibraryType Type)
 
 void NativeExecutedTarget::removeFile(const path &fn, bool binary_dir)
 {
+    invalidateCommands();
     remove_full(fn);
     Target::removeFile(fn, binary_dir);
 }
@@ -2422,17 +2788,11 @@ void NativeExecutedTarget::configureFile(path from, path to, ConfigureFlags flag
 
 void NativeExecutedTarget::configureFile1(const path &from, const path &to, ConfigureFlags flags) const
 {
-    static const std::regex cmDefineRegex(R"xxx(#cmakedefine[ \t]+([A-Za-z_0-9]*)([^\r\n]*?)[\r\n])xxx");
-    static const std::regex cmDefine01Regex(R"xxx(#cmakedefine01[ \t]+([A-Za-z_0-9]*)[^\r\n]*?[\r\n])xxx");
-    static const std::regex mesonDefine(R"xxx(#mesondefine[ \t]+([A-Za-z_0-9]*)[^\r\n]*?[\r\n])xxx");
-    static const std::regex undefDefine(R"xxx(#undef[ \t]+([A-Za-z_0-9]*)[^\r\n]*?[\r\n])xxx");
-    static const std::regex cmAtVarRegex("@([A-Za-z_0-9/.+-]+)@");
-    static const std::regex cmNamedCurly("\\$\\{([A-Za-z0-9/_.+-]+)\\}");
-
     static const std::set<std::string> offValues{
         "","OFF","0","NO","FALSE","N","IGNORE",
     };
 
+    prepare_inputs.insert(from);
     auto s = read_file(from);
 
     if ((int)flags & (int)ConfigureFlags::CopyOnly)
@@ -2452,65 +2812,164 @@ void NativeExecutedTarget::configureFile1(const path &from, const path &to, Conf
         return String();
     };
 
-    std::smatch m;
-
-    // @vars@
-    while (std::regex_search(s, m, cmAtVarRegex) ||
-        std::regex_search(s, m, cmNamedCurly))
+    auto is_off = [](const String &v)
     {
-        auto repl = find_repl(m[1].str());
-        s = m.prefix().str() + repl + m.suffix().str();
-    }
+        return offValues.find(boost::to_upper_copy(v)) != offValues.end();
+    };
 
-    // #mesondefine
-    while (std::regex_search(s, m, mesonDefine))
+    auto is_var_char = [](char c)
     {
-        auto repl = find_repl(m[1].str());
-        if (offValues.find(boost::to_upper_copy(repl)) != offValues.end())
-            s = m.prefix().str() + "/* #undef " + m[1].str() + " */" + "\n" + m.suffix().str();
-        else
-            s = m.prefix().str() + "#define " + m[1].str() + " " + repl + "\n" + m.suffix().str();
-    }
+        return isalnum((unsigned char)c) || c == '_' || c == '/' || c == '.' || c == '+' || c == '-';
+    };
 
-    // #undef
-    if ((int)flags & (int)ConfigureFlags::EnableUndefReplacements)
-    while (std::regex_search(s, m, undefDefine))
+    // @vars@ and ${vars}
+    // values are expanded too, depth limit protects from self references
+    std::function<void(const String &, String &, int)> expand;
+    expand = [&expand, &find_repl, &is_var_char](const String &in, String &out, int depth)
     {
-        auto repl = find_repl(m[1].str());
-        if (offValues.find(boost::to_upper_copy(repl)) != offValues.end())
-            s = m.prefix().str() + m.suffix().str();
-        else
-            s = m.prefix().str() + "#define " + m[1].str() + " " + repl + "\n" + m.suffix().str();
-    }
+        size_t i = 0;
+        while (i < in.size())
+        {
+            size_t b;
+            char close;
+            if (in[i] == '@')
+            {
+                b = i + 1;
+                close = '@';
+            }
+            else if (in[i] == '$' && i + 1 < in.size() && in[i + 1] == '{')
+            {
+                b = i + 2;
+                close = '}';
+            }
+            else
+            {
+                out += in[i++];
+                continue;
+            }
 
-    // #cmakedefine
-    while (std::regex_search(s, m, cmDefineRegex))
+            auto e = b;
+            while (e < in.size() && is_var_char(in[e]))
+                e++;
+            if (e == b || e == in.size() || in[e] != close)
+            {
+                // skipped chars cannot start another variable
+                out.append(in, i, e - i);
+                i = e;
+                continue;
+            }
+
+            auto v = find_repl(in.substr(b, e - b));
+            if (depth < 16)
+                expand(v, out, depth + 1);
+            else
+                out += v;
+            i = e + 1;
+        }
+    };
+
+    String v;
+    v.reserve(s.size());
+    expand(s, v, 0);
+
+    enum
     {
-        auto repl = find_repl(m[1].str());
-        if (offValues.find(boost::to_upper_copy(repl)) != offValues.end())
-            s = m.prefix().str() + "/* #undef " + m[1].str() + m[2].str() + " */\n" + m.suffix().str();
-        else
-            s = m.prefix().str() + "#define " + m[1].str() + m[2].str() + "\n" + m.suffix().str();
-    }
+        None,
+        CMakeDefine,
+        CMakeDefine01,
+        MesonDefine,
+        Undef,
+    };
+
+    const bool undefs = (int)flags & (int)ConfigureFlags::EnableUndefReplacements;
 
-    // #cmakedefine01
-    while (std::regex_search(s, m, cmDefine01Regex))
+    // directives, line by line
+    String r;
+    r.reserve(v.size());
+    size_t p = 0;
+    while (p < v.size())
     {
-        auto repl = find_repl(m[1].str());
-        if (offValues.find(boost::to_upper_copy(repl)) != offValues.end())
-            s = m.prefix().str() + "#define " + m[1].str() + " 0" + "\n" + m.suffix().str();
-        else
-            s = m.prefix().str() + "#define " + m[1].str() + " 1" + "\n" + m.suffix().str();
-    }
+        auto n = v.find('\n', p);
+        if (n == v.npos)
+        {
+            // directive must end with a newline
+            r.append(v, p, v.npos);
+            break;
+        }
+        auto e = n > p && v[n - 1] == '\r' ? n - 1 : n;
+        const auto line = v.substr(p, e - p);
+        const auto eol = v.substr(e, n + 1 - e);
+        p = n + 1;
 
-    //for (auto &[k, v] : Variables)
-    //boost::replace_all(s, "@" + k + "@", v);
+        int type = None;
+        size_t after = 0;
+        auto pos = line.find('#');
+        auto starts_with = [&line, &pos, &after](const String &d)
+        {
+            if (line.compare(pos, d.size(), d) != 0 || pos + d.size() >= line.size())
+                return false;
+            auto c = line[pos + d.size()];
+            if (c != ' ' && c != '\t')
+                return false;
+            after = pos + d.size();
+            return true;
+        };
+        for (; pos != line.npos; pos = line.find('#', pos + 1))
+        {
+            if (starts_with("#cmakedefine01"))
+                type = CMakeDefine01;
+            else if (starts_with("#cmakedefine"))
+                type = CMakeDefine;
+            else if (starts_with("#mesondefine"))
+                type = MesonDefine;
+            else if (undefs && starts_with("#undef"))
+                type = Undef;
+            if (type != None)
+                break;
+        }
 
-    // handle ${k} vars
-    // remove the rest of variables
-    //s = std::regex_replace(s, r, "");
+        if (type == None)
+        {
+            r += line;
+            r += eol;
+            continue;
+        }
+
+        auto b = line.find_first_not_of(" \t", after);
+        auto ne = b;
+        while (ne < line.size() && (isalnum((unsigned char)line[ne]) || line[ne] == '_'))
+            ne++;
+        const auto name = line.substr(b, ne - b);
+        const auto rest = line.substr(ne);
+        const auto repl = find_repl(name);
+        const auto off = is_off(repl);
+
+        r.append(line, 0, pos);
+        switch (type)
+        {
+        case MesonDefine:
+            if (off)
+                r += "/* #undef " + name + " */" + eol;
+            else
+                r += "#define " + name + " " + repl + eol;
+            break;
+        case Undef:
+            if (!off)
+                r += "#define " + name + " " + repl + eol;
+            break;
+        case CMakeDefine:
+            if (off)
+                r += "/* #undef " + name + rest + " */" + eol;
+            else
+                r += "#define " + name + rest + eol;
+            break;
+        case CMakeDefine01:
+            r += "#define " + name + (off ? " 0" : " 1") + eol;
+            break;
+        }
+    }
 
-    fileWriteOnce(to, s);
+    fileWriteOnce(to, r);
 }
 
 void NativeExecutedTarget::setChecks(const String &name)
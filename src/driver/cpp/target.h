@@ -17,8 +17,10 @@
 #include <types.h>
 
 #include <any>
+#include <atomic>
 #include <mutex>
 #include <optional>
+#include <set>
 
 #define IMPORT_LIBRARY "cppan.dll"
 
@@ -153,7 +155,94 @@ using SharedLibrary = SharedLibraryTarget;
 
 struct SW_DRIVER_CPP_API TargetBase : Node, LanguageStorage, ProjectDirectories
 {
-    using TargetMap = std::unordered_map<PackageId, TargetBaseTypePtr>;
+    /// targets by package id with an index by package path for dependency resolution
+    struct TargetMap : private std::unordered_map<PackageId, TargetBaseTypePtr>
+    {
+        using base = std::unordered_map<PackageId, TargetBaseTypePtr>;
+
+        using base::key_type;
+        using base::mapped_type;
+        using base::value_type;
+        using base::iterator;
+        using base::const_iterator;
+
+        using base::begin;
+        using base::end;
+        using base::find;
+        using base::count;
+        using base::size;
+        using base::empty;
+
+        mapped_type &operator[](const PackageId &p)
+        {
+            versions[p.ppath].insert(p.version);
+            return base::operator[](p);
+        }
+
+        template <class ... Args>
+        std::pair<iterator, bool> emplace(Args && ... args)
+        {
+            auto r = base::emplace(std::forward<Args>(args)...);
+            if (r.second)
+                versions[r.first->first.ppath].insert(r.first->first.version);
+            return r;
+        }
+
+        std::pair<iterator, bool> insert(const value_type &v)
+        {
+            return emplace(v);
+        }
+
+        iterator erase(const_iterator i)
+        {
+            removeVersion(i->first);
+            return base::erase(i);
+        }
+
+        size_t erase(const PackageId &p)
+        {
+            if (!base::erase(p))
+                return 0;
+            removeVersion(p);
+            return 1;
+        }
+
+        void clear()
+        {
+            base::clear();
+            versions.clear();
+        }
+
+        /// returns target with max version satisfying the range
+        const_iterator findSuitable(const UnresolvedPackage &p) const
+        {
+            auto i = versions.find(p.ppath);
+            if (i == versions.end())
+                return end();
+            for (auto v = i->second.rbegin(); v != i->second.rend(); ++v)
+            {
+                if (!p.range.hasVersion(*v))
+                    continue;
+                auto t = find(PackageId(p.ppath, *v));
+                if (t != end())
+                    return t;
+            }
+            return end();
+        }
+
+    private:
+        std::unordered_map<PackagePath, std::set<Version>> versions;
+
+        void removeVersion(const PackageId &p)
+        {
+            auto i = versions.find(p.ppath);
+            if (i == versions.end())
+                return;
+            i->second.erase(p.version);
+            if (i->second.empty())
+                versions.erase(i);
+        }
+    };
 
     struct SettingsX
     {
@@ -419,6 +508,14 @@ struct SW_DRIVER_CPP_API Target : TargetBase, std::enable_shared_from_this<Targe
 
     virtual void removeFile(const path &fn, bool binary_dir = false);
 
+    /// targets that must finish the current prepare pass before this one runs it
+    /// with dummy = true also returns dummy (tool) deps which do not order passes
+    virtual std::vector<Target *> getPrepareDependencies(bool dummy = false) const { return {}; }
+    /// moves used dummy targets into solution children
+    /// called by prepare scheduler under its lock after pass 3
+    virtual void promoteDummyDependencies() {}
+    int getPreparePass() const { return prepare_pass; }
+
 protected:
     int prepare_pass = 1;
 };
@@ -671,6 +768,8 @@ struct SW_DRIVER_CPP_API NativeExecutedTarget : NativeTarget,
     bool ExportIfStatic = false;
     path InstallDirectory;
     bool PackageDefinitions = false;
+    /// generate pch from external headers used by most target files (see --auto-pch)
+    bool AutoPrecompiledHeader = false;
 
     bool ImportFromBazel = false;
     StringSet BazelNames;
@@ -693,9 +792,14 @@ struct SW_DRIVER_CPP_API NativeExecutedTarget : NativeTarget,
     void init2() override;
     void addPackageDefinitions(bool defs = false);
     std::shared_ptr<builder::Command> getCommand() const override;
+    /// cached after the first call, see invalidateCommands()
     Commands getCommands() const override;
+    /// drop cached commands after changing the target
+    void invalidateCommands();
     Files getGeneratedDirs() const override;
     bool prepare() override;
+    std::vector<Target *> getPrepareDependencies(bool dummy = false) const override;
+    void promoteDummyDependencies() override;
     path getOutputFile() const override;
     path getImportLibrary() const override;
     void setChecks(const String &name);
@@ -704,7 +808,11 @@ struct SW_DRIVER_CPP_API NativeExecutedTarget : NativeTarget,
     bool hasSourceFiles() const;
     Files gatherAllFiles() const;
     Files gatherIncludeDirectories() const;
+    /// files read while loading and preparing the target, e.g. configured files
+    const Files &getPrepareInputs() const { return prepare_inputs; }
     NativeLinker *getSelectedTool() const;
+    /// options of protected, public and interface groups for dependents, computed once
+    std::shared_ptr<const NativeOptions> getUsageRequirements() const;
     void setOutputDir(const path &dir);
     virtual path getOutputDir() const;
     void removeFile(const path &fn, bool binary_dir = false) override;
@@ -770,6 +878,7 @@ protected:
     FilesOrdered gatherLinkDirectories() const;
     FilesOrdered gatherLinkLibraries() const;
     bool prepareLibrary(LibraryType Type);
+    void inheritDependencies();
     void setOutputFile();
     void initLibrary(LibraryType Type);
     void configureFile1(const path &from, const path &to, ConfigureFlags flags) const;
@@ -778,11 +887,25 @@ protected:
 private:
     path OutputDir;
     bool already_built = false;
+    bool has_precompiled_header = false;
+    // transitive deps passed to dependents (non-private inheritance), computed once on pass 3
+    std::vector<DependencyPtr> ExportedDependencies;
+    std::atomic<bool> exported_dependencies_ready{ false };
+    mutable std::shared_ptr<const NativeOptions> UsageRequirements;
+    mutable std::once_flag usage_requirements_once;
+    mutable std::optional<Commands> cached_commands;
+    /// execution plan clears command deps when destroyed, they are restored from here
+    mutable std::unordered_map<builder::Command *, Commands> cached_dependencies;
+    mutable Files prepare_inputs;
+    mutable std::mutex commands_mutex;
 
     void autoDetectOptions();
+    void addAutoPrecompiledHeader();
     path getOutputFileName(const path &root) const;
     Commands getGeneratedCommands() const;
+    Commands getCommands1() const;
     void resolvePostponedSourceFiles();
+    const std::vector<DependencyPtr> *getExportedDependencies() const;
 
     path getPatchDir(bool binary_dir) const;
 };
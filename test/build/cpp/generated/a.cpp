@@ -0,0 +1,6 @@
+#include "a.h"
+
+int a()
+{
+    return A_VALUE;
+}
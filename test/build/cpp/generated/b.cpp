@@ -0,0 +1,6 @@
+#include "b.h"
+
+int b()
+{
+    return B_VALUE;
+}
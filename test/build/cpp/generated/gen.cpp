@@ -0,0 +1,9 @@
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return 1;
+    std::cout << "#define " << argv[1] << "_VALUE 1\n";
+    return 0;
+}
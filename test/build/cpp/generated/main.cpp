@@ -0,0 +1,7 @@
+int a();
+int b();
+
+int main()
+{
+    return a() + b() - 2;
+}
@@ -0,0 +1,32 @@
+// two targets with own generated headers,
+// each target's sources must wait for its own generator
+
+void build(Solution &s)
+{
+    auto &gen = s.addTarget<ExecutableTarget>("gen");
+    gen += "gen.cpp";
+
+    auto add_generated = [&s, &gen](auto &t, const String &name, const path &fn)
+    {
+        auto c = std::make_shared<Command>();
+        c->fs = s.getSolution()->fs;
+        c->setProgram(gen);
+        c->args.push_back(name);
+        t += c->redirectStdout(t.BinaryDir / fn);
+        t.Storage.push_back(c);
+        auto d = t + gen;
+        d->Dummy = true;
+    };
+
+    auto &a = s.addTarget<StaticLibraryTarget>("a");
+    a += "a.cpp";
+    add_generated(a, "A", "a.h");
+
+    auto &b = s.addTarget<StaticLibraryTarget>("b");
+    b += "b.cpp";
+    add_generated(b, "B", "b.h");
+
+    auto &exe = s.addTarget<ExecutableTarget>("exe");
+    exe += "main.cpp";
+    exe += a, b;
+}
@@ -0,0 +1,157 @@
+#include <concurrent_map.h>
+
+#include <primitives/filesystem.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+struct BadHash
+{
+    size_t operator()(const std::string &) const
+    {
+        return 42;
+    }
+};
+
+TEST_CASE("Checking collisions", "[concurrent_map]")
+{
+    ConcurrentHashMap<std::string, int, BadHash> m;
+
+    auto a = m.insert("a", 1);
+    auto b = m.insert("b", 2);
+    REQUIRE(a.second);
+    REQUIRE(b.second);
+    REQUIRE(a.first != b.first);
+    REQUIRE(*m.find("a") == 1);
+    REQUIRE(*m.find("b") == 2);
+    REQUIRE(m.find("c") == nullptr);
+
+    auto a2 = m.insert("a", 3);
+    REQUIRE_FALSE(a2.second);
+    REQUIRE(a2.first == a.first);
+    REQUIRE(*a2.first == 1);
+    REQUIRE(m.size() == 2);
+}
+
+TEST_CASE("Checking snapshots", "[concurrent_map]")
+{
+    ConcurrentHashMap<std::string, int> m;
+    for (int i = 0; i < 100; i++)
+        m[std::to_string(i)] = i;
+
+    auto i = m.getIterator();
+    m["new"] = 100;
+
+    int n = 0;
+    for (; i.isValid(); i.next())
+    {
+        REQUIRE(std::to_string(*i.getValue()) == i.getKey());
+        n++;
+    }
+    REQUIRE(n == 100);
+    REQUIRE(m.size() == 101);
+}
+
+TEST_CASE("Checking zero key", "[concurrent_map]")
+{
+    ConcurrentMapSimple<size_t> m;
+    REQUIRE_NOTHROW(m.insert_ptr(0, 5));
+    REQUIRE(m[0] == 5);
+
+    // zero key must not alias any other key
+    m.insert_ptr(0x9e3779b97f4a7c15, 6);
+    REQUIRE(m[0] == 5);
+    REQUIRE(m[0x9e3779b97f4a7c15] == 6);
+
+    size_t n = 0;
+    m.forEach([&n](auto k, auto v) { n++; });
+    REQUIRE(n == 2);
+}
+
+TEST_CASE("Checking concurrent inserts", "[concurrent_map]")
+{
+    ConcurrentHashMap<std::string, int> m;
+    std::atomic_int inserted = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&m, &inserted, t]
+        {
+            for (int i = 0; i < 10000; i++)
+            {
+                if (m.insert(std::to_string(i), t).second)
+                    inserted++;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    REQUIRE(inserted == 10000);
+    REQUIRE(m.size() == 10000);
+}
+
+// run with "[.benchmark]"
+TEST_CASE("Insert/find benchmark", "[.benchmark]")
+{
+    const int n_paths = 200000;
+    const int n_threads = std::thread::hardware_concurrency();
+
+    std::vector<path> paths;
+    for (int i = 0; i < n_paths; i++)
+        paths.push_back(path("/usr/include/some/long/directory") / std::to_string(i % 97) / (std::to_string(i) + ".h"));
+
+    auto bench = [&paths, n_threads](const String &name, auto &m)
+    {
+        auto run = [&](int finds)
+        {
+            std::vector<std::thread> threads;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int t = 0; t < n_threads; t++)
+            {
+                threads.emplace_back([&m, &paths, t, finds, n_threads]
+                {
+                    for (int r = 0; r < finds; r++)
+                    {
+                        for (size_t i = t; i < paths.size(); i += n_threads)
+                            m.insert(paths[i]);
+                    }
+                });
+            }
+            for (auto &t : threads)
+                t.join();
+            return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        };
+
+        auto ti = run(1);
+        auto tf = run(10);
+        std::cout << name << ": insert " << ti << " s, find " << tf << " s" << std::endl;
+    };
+
+    {
+        ConcurrentHashMap<path, int> m;
+        bench("ConcurrentHashMap (full keys)", m);
+    }
+
+    {
+        // previous implementation: junction map keyed by 64-bit hash only
+        struct HashOnly : ConcurrentMapSimple<int>
+        {
+            auto insert(const path &p)
+            {
+                return ConcurrentMapSimple<int>::insert(std::hash<path>()(p));
+            }
+        } m;
+        bench("ConcurrentMapSimple (hash keys)", m);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
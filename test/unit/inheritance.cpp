@@ -0,0 +1,187 @@
+#ifndef CPPAN_PACKAGE_API
+#define CPPAN_PACKAGE_API
+#endif
+
+// builder stuff
+#include <solution.h>
+
+#include <deque>
+#include <set>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch2/catch.hpp>
+
+using namespace sw;
+
+struct TestTarget : LibraryTarget
+{
+    using NativeExecutedTarget::inheritDependencies;
+};
+
+struct Graph
+{
+    struct Edge
+    {
+        int to;
+        bool Private;
+        bool idir_only;
+    };
+
+    std::vector<std::vector<Edge>> edges;
+
+    Graph(int n)
+        : edges(n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            // public chains of 8 targets
+            if (i % 8 != 0)
+                edges[i].push_back({ i - 1, false, false });
+            if (i % 7 == 0 && i >= 2)
+                edges[i].push_back({ i - 2, false, true });
+            if (i >= 5)
+                edges[i].push_back({ i - 5, true, false });
+            if (i >= 13)
+                edges[i].push_back({ i - 13, true, false });
+        }
+    }
+
+    // target -> full (not include directories only)
+    std::map<int, bool> closure(int i) const
+    {
+        std::map<int, bool> r;
+        std::deque<std::pair<int, bool>> q;
+        auto add = [&r, &q](int to, bool full)
+        {
+            auto [it, inserted] = r.emplace(to, full);
+            if (!inserted && (it->second || !full))
+                return;
+            it->second = full;
+            q.emplace_back(to, full);
+        };
+        for (auto &e : edges[i])
+            add(e.to, !e.idir_only);
+        while (!q.empty())
+        {
+            auto [t, full] = q.front();
+            q.pop_front();
+            for (auto &e : edges[t])
+            {
+                if (!e.Private && e.to != i)
+                    add(e.to, full && !e.idir_only);
+            }
+        }
+        return r;
+    }
+};
+
+static void inherit(int n)
+{
+    Build s;
+    Graph g(n);
+
+    std::vector<TestTarget *> targets;
+    std::unordered_map<const Target *, int> ids;
+    for (int i = 0; i < n; i++)
+    {
+        auto &t = s.add<TestTarget>("t" + std::to_string(i));
+        for (auto &e : g.edges[i])
+        {
+            auto d = e.Private ? t.Private + *targets[e.to] : t.Public + *targets[e.to];
+            d->IncludeDirectoriesOnly = e.idir_only;
+        }
+        targets.push_back(&t);
+        ids[&t] = i;
+    }
+
+    for (auto t : targets)
+        t->inheritDependencies();
+
+    for (int i = 0; i < n; i++)
+    {
+        std::map<int, bool> r;
+        for (auto &d : targets[i]->Dependencies)
+            r[ids[d->target.lock().get()]] = !d->IncludeDirectoriesOnly;
+        REQUIRE(r == g.closure(i));
+    }
+}
+
+TEST_CASE("Checking dependency inheritance", "[inheritance]")
+{
+    inherit(200);
+}
+
+TEST_CASE("Checking deep public chain", "[inheritance]")
+{
+    // every target gets the whole chain below it
+    const int n = 500;
+
+    Build s;
+    std::vector<TestTarget *> targets;
+    for (int i = 0; i < n; i++)
+    {
+        auto &t = s.add<TestTarget>("t" + std::to_string(i));
+        if (i)
+            t.Public + *targets.back();
+        targets.push_back(&t);
+    }
+    for (auto t : targets)
+        t->inheritDependencies();
+
+    for (int i = 0; i < n; i++)
+    {
+        std::set<String> r;
+        for (auto &d : targets[i]->Dependencies)
+        {
+            REQUIRE_FALSE(d->IncludeDirectoriesOnly);
+            r.insert(d->target.lock()->pkg.ppath.toString());
+        }
+        std::set<String> e;
+        for (int j = 0; j < i; j++)
+            e.insert("t" + std::to_string(j));
+        REQUIRE(r == e);
+    }
+}
+
+TEST_CASE("Checking protected inheritance", "[inheritance]")
+{
+    Build s;
+
+    auto &a = s.add<TestTarget>("p.a");
+    auto &b = s.add<TestTarget>("p.b");
+    auto &c = s.add<TestTarget>("p.c");
+    auto &d = s.add<TestTarget>("q.d");
+    auto &e = s.add<TestTarget>("p.e");
+    auto &f = s.add<TestTarget>("q.f");
+
+    // protected deps are inherited only by targets with the same parent as the dep
+    b.Protected + a;
+    c.Public + b;
+    d.Public + b;
+    e.Public + c;
+    f.Public + c;
+
+    for (auto t : { &a, &b, &c, &d, &e, &f })
+        t->inheritDependencies();
+
+    auto deps = [](const TestTarget &t)
+    {
+        std::set<String> r;
+        for (auto &d : t.Dependencies)
+            r.insert(d->target.lock()->pkg.ppath.toString());
+        return r;
+    };
+
+    REQUIRE(deps(b) == std::set<String>{ "p.a" });
+    REQUIRE(deps(c) == std::set<String>{ "p.a", "p.b" });
+    REQUIRE(deps(d) == std::set<String>{ "p.b" });
+    REQUIRE(deps(e) == std::set<String>{ "p.a", "p.b", "p.c" });
+    REQUIRE(deps(f) == std::set<String>{ "p.b", "p.c" });
+}
+
+int main(int argc, char **argv)
+{
+    Catch::Session().run(argc, argv);
+
+    return 0;
+}
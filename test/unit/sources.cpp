@@ -74,6 +74,28 @@ TEST_CASE("Checking adding of source files", "[add]")
     }
 }
 
+TEST_CASE("Checking compiled file regexes", "[regex]")
+{
+    const Strings patterns{
+        ".*", ".*\\.cpp", "a.*\\.cpp", "src/.*\\.[ch]", "main\\.cpp", "ab*c", "a\\.*c",
+        ".*\\.(cpp|c)", "x|y\\.c", "[a-z]+\\.h", "a(b|c).*d", "\\d+\\.txt", ".*?\\.c",
+    };
+    const Strings files{
+        "", "a", "a.cpp", "ab.cpp", "main.cpp", "mainxcpp", "src/x.c", "src/x.h", "src/y/z.h",
+        "ac", "abbc", "a..c", "abd", "acxd", "12.txt", "x", "y.c", "a.c", "a.cpp\n",
+    };
+    for (auto &p : patterns)
+    {
+        FileRegex r(p);
+        std::regex rr(p);
+        for (auto &f : files)
+        {
+            INFO(p << " " << f);
+            REQUIRE(r.match(f) == std::regex_match(f, rr));
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     Catch::Session().run(argc, argv);